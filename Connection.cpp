@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <system_error>
 
 //NOTE: much of the sockets code herein is based on http-tweak's single-header http server
 // see: https://github.com/ixchow/http-tweak
@@ -13,7 +14,205 @@
 
 
 //---------------------------------
-//Polling helper used by both server and client:
+//Read/write helpers used by both polling backends:
+
+//read everything available on a connection; returns false if the connection was closed:
+static bool read_connection(char const *where, Connection &c, std::function< void(Connection *, Connection::Event event) > const &on_event) {
+	//data is read straight into the free space of recv_buffer, growing it when it gets low:
+	const size_t MinFree = 16384;
+
+	bool got_data = false;
+	while (true) {
+		c.recv_buffer.reserve(MinFree);
+		RingBuffer::Span spans[2];
+		size_t span_count = c.recv_buffer.free_spans(spans);
+		size_t free = c.recv_buffer.capacity() - c.recv_buffer.size();
+
+		#ifdef _WIN32
+		ssize_t ret = recv(c.socket, spans[0].data, int(spans[0].size), MSG_DONTWAIT);
+		free = spans[0].size;
+		#else
+		struct iovec iov[2];
+		for (size_t s = 0; s < span_count; ++s) {
+			iov[s].iov_base = spans[s].data;
+			iov[s].iov_len = spans[s].size;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = span_count;
+		ssize_t ret = recvmsg(c.socket, &msg, MSG_DONTWAIT); //(readv, but without blocking on blocking sockets)
+		#endif
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~ but no (more) data
+			break;
+		} else if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0 || ret > (ssize_t)free) {
+			//~problem~ so remove connection
+			if (ret == 0) {
+				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+			} else if (ret < 0) {
+				std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+			} else {
+				std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+			}
+			//let the handler see whatever arrived before the close:
+			if (got_data && on_event) on_event(&c, Connection::OnRecv);
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return false;
+		} else { //ret > 0
+			c.recv_buffer.commit(ret);
+			got_data = true;
+			#ifndef __linux__
+			//(select is level-triggered, so one read per poll is enough)
+			break;
+			#endif
+		}
+	}
+	if (got_data && on_event) on_event(&c, Connection::OnRecv);
+	return true;
+}
+
+//send as much of a connection's send_buffer as the socket will take; returns false if the socket is full or the connection was closed:
+static bool write_connection(char const *where, Connection &c, std::function< void(Connection *, Connection::Event event) > const &on_event) {
+	while (!c.send_buffer.empty()) {
+		RingBuffer::Span spans[2];
+		size_t span_count = c.send_buffer.data_spans(spans);
+
+		#ifdef _WIN32
+		ssize_t ret = send(c.socket, spans[0].data, int(spans[0].size), MSG_DONTWAIT);
+		#else
+		struct iovec iov[2];
+		for (size_t s = 0; s < span_count; ++s) {
+			iov[s].iov_base = spans[s].data;
+			iov[s].iov_len = spans[s].size;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = span_count;
+		ssize_t ret = sendmsg(c.socket, &msg, MSG_DONTWAIT); //(writev, but without blocking on blocking sockets)
+		#endif
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~, but don't keep trying
+			return false;
+		} else if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
+			if (ret < 0) {
+				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
+			} else { assert(ret == 0 || ret > (ssize_t)c.send_buffer.size());
+				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << c.send_buffer.size() << "], disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return false;
+		} else { //ret seems reasonable
+			c.send_buffer.consume(ret);
+		}
+	}
+	return true;
+}
+
+#ifdef __linux__
+//---------------------------------
+//Polling helper used by both server and client (epoll version):
+// Sockets stay registered with the epoll instance for as long as they are open
+// (closing a socket removes it), so the cost of a poll depends on the number
+// of sockets with something to do rather than on the number of connections.
+
+static void register_connection(char const *where, int epoll_fd, Connection &c) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = &c; //(connections live in a std::list, so this pointer stays valid)
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.socket, &ev) != 0) {
+		std::cerr << "[" << where << "] epoll_ctl() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+		c.close();
+		return;
+	}
+	c.writable = true; //(edge-triggered, so assume writable until send() says otherwise)
+}
+
+void poll_connections(
+	char const *where,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	int epoll_fd,
+	SOCKET listen_socket = INVALID_SOCKET) {
+
+	//don't wait if there's data that could be sent right now:
+	// (this walks the list, but only checks members -- no system calls)
+	for (auto &c : connections) {
+		if (c.socket != INVALID_SOCKET && c.writable && !c.send_buffer.empty()) {
+			timeout = 0.0;
+			break;
+		}
+	}
+
+	const int MaxEvents = 256;
+	static thread_local struct epoll_event *events = new struct epoll_event[MaxEvents];
+
+	int count = epoll_wait(epoll_fd, events, MaxEvents, int(std::lround(std::ceil(timeout * 1000.0))));
+	if (count < 0) {
+		if (errno != EINTR) {
+			std::cerr << "[" << where << "] epoll_wait() returned error " << errno << "(" << strerror(errno) << ")." << std::endl;
+		}
+		count = 0;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		if (events[i].data.ptr == nullptr) {
+			//listen socket is ready -- accept until it would block:
+			assert(listen_socket != INVALID_SOCKET);
+			while (true) {
+				SOCKET got = accept4(listen_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (got == INVALID_SOCKET) {
+					if (errno == EINTR || errno == ECONNABORTED) continue;
+					if (errno != EAGAIN && errno != EWOULDBLOCK) {
+						std::cerr << "[" << where << "] accept() returned error " << errno << "(" << strerror(errno) << ")." << std::endl;
+					}
+					break;
+				}
+				connections.emplace_back();
+				connections.back().socket = got;
+				register_connection(where, epoll_fd, connections.back());
+				if (!connections.back()) continue;
+				std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
+				if (on_event) on_event(&connections.back(), Connection::OnOpen);
+			}
+			continue;
+		}
+
+		Connection &c = *reinterpret_cast< Connection * >(events[i].data.ptr);
+		if (c.socket == INVALID_SOCKET) continue; //closed earlier in this poll
+
+		if (events[i].events & EPOLLOUT) {
+			c.writable = true;
+		}
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			//(hangups and errors show up as a zero or failed recv)
+			read_connection(where, c, on_event);
+		}
+	}
+
+	//process responses:
+	// (handlers may have queued data during the reads above, so check every writable connection)
+	for (auto &c : connections) {
+		if (c.socket == INVALID_SOCKET || !c.writable || c.send_buffer.empty()) continue;
+		if (!write_connection(where, c, on_event)) {
+			//socket is full (or closed); wait for EPOLLOUT before trying again:
+			c.writable = false;
+		}
+	}
+}
+
+#else
+//---------------------------------
+//Polling helper used by both server and client (portable select version):
 void poll_connections(
 	char const *where,
 	std::list< Connection > &connections,
@@ -34,7 +233,7 @@ void poll_connections(
 	}
 
 	//add each connection's socket to read (and possibly write) sets:
-	for (auto c : connections) {
+	for (auto const &c : connections) {
 		if (c.socket != INVALID_SOCKET) {
 			max = std::max(max, int(c.socket));
 			FD_SET(c.socket, &read_fds);
@@ -79,62 +278,21 @@ void poll_connections(
 		}
 	}
 
-	const uint32_t BufferSize = 20000;
-	static thread_local char *buffer = new char[BufferSize];
-
 	//process requests:
 	for (auto &c : connections) {
 		//only read from valid sockets marked readable:
 		if (c.socket == INVALID_SOCKET || !FD_ISSET(c.socket, &read_fds)) continue;
-
-		ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
-		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-			//~no problem~ but no data
-		} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
-			//~problem~ so remove connection
-			if (ret == 0) {
-				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
-			} else if (ret < 0) {
-				std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
-			} else {
-				std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
-			}
-			c.close();
-			if (on_event) on_event(&c, Connection::OnClose);
-		} else { //ret > 0
-			c.recv_buffer.insert(c.recv_buffer.end(), buffer, buffer + ret);
-			if (on_event) on_event(&c, Connection::OnRecv);
-		}
+		read_connection(where, c, on_event);
 	}
 
 	//process responses:
 	for (auto &c : connections) {
 		//don't bother with connections unless they are valid, have something to send, and are marked writable:
 		if (c.socket == INVALID_SOCKET || c.send_buffer.empty() || !FD_ISSET(c.socket, &write_fds)) continue;
-		
-		#ifdef _WIN32
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), int(c.send_buffer.size()), MSG_DONTWAIT);
-		#else
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), c.send_buffer.size(), MSG_DONTWAIT);
-		#endif 
-		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-			//~no problem~, but don't keep trying
-			break;
-		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
-			if (ret < 0) {
-				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
-			} else { assert(ret == 0 || ret > (ssize_t)c.send_buffer.size());
-				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << c.send_buffer.size() << "], disconnecting." << std::endl;
-			}
-			c.close();
-			if (on_event) on_event(&c, Connection::OnClose);
-		} else { //ret seems reasonable
-			c.send_buffer.erase(c.send_buffer.begin(), c.send_buffer.begin() + ret);
-		}
+		write_connection(where, c, on_event);
 	}
-
-		
 }
+#endif
 
 //---------------------------------
 
@@ -221,16 +379,51 @@ Server::Server(std::string const &port) {
 	}
 
 	{ //listen on socket
-		int ret = ::listen(listen_socket, 5);
+		int ret = ::listen(listen_socket, SOMAXCONN);
 		if (ret < 0) {
 			closesocket(listen_socket);
 			throw std::system_error(errno, std::system_category(), "failed to listen on socket");
 		}
 	}
+
+	#ifdef __linux__
+	{ //register listen socket with epoll:
+		//(nonblocking, so poll can accept until the backlog is empty)
+		int flags = fcntl(listen_socket, F_GETFL, 0);
+		if (flags < 0 || fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to make listen socket nonblocking");
+		}
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+		}
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.ptr = nullptr; //(marks the listen socket)
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &ev) != 0) {
+			closesocket(listen_socket);
+			::close(epoll_fd);
+			throw std::system_error(errno, std::system_category(), "failed to register listen socket with epoll");
+		}
+	}
+	#endif
+}
+
+Server::~Server() {
+	#ifdef __linux__
+	if (epoll_fd >= 0) ::close(epoll_fd);
+	#endif
 }
 
 void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	#ifdef __linux__
+	poll_connections("Server::poll", connections, on_event, timeout, epoll_fd, listen_socket);
+	#else
 	poll_connections("Server::poll", connections, on_event, timeout, listen_socket);
+	#endif
 
 	//reap closed clients:
 	for (auto connection = connections.begin(); connection != connections.end(); /*later*/) {
@@ -307,10 +500,33 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 			throw std::runtime_error("Failed to connect to any of the addresses tried for server.");
 		}
 	}
+
+	#ifdef __linux__
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		connection.close();
+		throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+	}
+	register_connection("Client::Client", epoll_fd, connection);
+	if (!connection) {
+		::close(epoll_fd);
+		throw std::runtime_error("Failed to register connection with epoll.");
+	}
+	#endif
+}
+
+Client::~Client() {
+	#ifdef __linux__
+	if (epoll_fd >= 0) ::close(epoll_fd);
+	#endif
 }
 
 
 void Client::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	#ifdef __linux__
+	poll_connections("Client::poll", connections, on_event, timeout, epoll_fd, INVALID_SOCKET);
+	#else
 	poll_connections("Client::poll", connections, on_event, timeout, INVALID_SOCKET);
+	#endif
 }
 
@@ -22,10 +22,16 @@ typedef int ssize_t;
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h> //for struct iovec
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <sys/epoll.h> //Server and Client use epoll instead of select on linux
+#endif
 
 #define closesocket close
 typedef int SOCKET;
@@ -33,6 +39,8 @@ constexpr const SOCKET INVALID_SOCKET = -1;
 #endif
 //--------- ---------------------------------- ---------
 
+#include "RingBuffer.hpp"
+
 #include <vector>
 #include <list>
 #include <string>
@@ -52,7 +60,8 @@ int main(int argc, char **argv) {
 		server.poll([](Connection *connection, Connection::Event evt){
 			if (evt == Connection::OnRecv) {
 				//extract and erase data from the connection's recv_buffer:
-				std::vector< uint8_t > data = connection->recv_buffer;
+				std::vector< char > data(connection->recv_buffer.size());
+				connection->recv_buffer.peek(0, data.data(), data.size());
 				connection->recv_buffer.clear();
 				//send to other connections:
 
@@ -81,13 +90,14 @@ int main(int argc, char **argv) {
 //Thin wrapper around a (polling-based) TCP socket connection:
 struct Connection {
 	//Helper that will append any type to the send buffer:
+	// (copies raw bytes, padding and all -- use send_message from MessageSchema.hpp for structured messages)
 	template< typename T >
 	void send(T const &t) {
 		send_raw(&t, sizeof(T));
 	}
 	//Helper that will append raw bytes to the send buffer:
 	void send_raw(void const *data, size_t size) {
-		send_buffer.insert(send_buffer.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+		send_buffer.append(data, size);
 	}
 
 	//Call 'close' to mark a connection for discard:
@@ -102,12 +112,14 @@ struct Connection {
 	explicit operator bool() { return socket != INVALID_SOCKET; }
 
 	//To send data over a connection, append it to send_buffer:
-	std::vector< char > send_buffer;
+	RingBuffer send_buffer;
 	//When the connection receives data, it is appended to recv_buffer:
-	std::vector< char > recv_buffer;
+	// (consume() bytes from its front once you've handled them)
+	RingBuffer recv_buffer;
 
 	//internals:
 	SOCKET socket = INVALID_SOCKET;
+	bool writable = true; //(epoll only) false after send() would block, until the socket reports writable again
 
 	enum Event {
 		OnOpen,
@@ -127,6 +139,13 @@ struct Server {
 
 	std::list< Connection > connections;
 	SOCKET listen_socket = INVALID_SOCKET;
+
+	//on linux, sockets stay registered with an epoll instance, so polling doesn't rebuild fd sets:
+	#ifdef __linux__
+	int epoll_fd = -1;
+	#endif
+	~Server();
+	Server(Server const &) = delete; //(owns sockets)
 };
 
 
@@ -141,4 +160,10 @@ struct Client {
 
 	std::list< Connection > connections; //will only ever contain exactly one connection
 	Connection &connection; //reference to the only connection in the connections list
+
+	#ifdef __linux__
+	int epoll_fd = -1;
+	#endif
+	~Client();
+	Client(Client const &) = delete; //(owns sockets)
 };
@@ -21,9 +21,20 @@
  * These functions are grouped by 'tags', which allow some sequencing of calls.
  * (particularly, this is useful for loading large data blobs [e.g. "Meshes"] before looking up individual elements within them.)
  *
+ * Work that can happen off the main thread can start early and finish later:
+ *
+ * Load< Sound::Sample > music(LoadTagInit, LoadTagLate, [](){
+ *     return Sound::Sample::load_async(data_path("music.wav"));
+ * });
+ *
+ * (the function runs with the LoadTagInit functions; its result is waited on with the LoadTagLate ones.)
+ *
  */
 
+#include <cassert>
 #include <functional>
+#include <future>
+#include <memory>
 #include <stdexcept>
 
 enum LoadTag : uint32_t {
@@ -48,6 +59,22 @@ struct Load {
 		});
 	}
 
+	//Constructing a Load< T > with a start function calls it with the 'start_tag' functions,
+	// and waits for the future it returns with the 'tag' functions:
+	Load( LoadTag start_tag, LoadTag tag, const std::function< std::shared_future< T const * >() > &start_fn ) : value(nullptr) {
+		assert(start_tag <= tag);
+		auto pending = std::make_shared< std::shared_future< T const * > >();
+		add_load_function(start_tag, [pending,start_fn](){
+			*pending = start_fn();
+		});
+		add_load_function(tag, [this,pending](){
+			this->value = pending->get();
+			if (!(this->value)) {
+				throw std::runtime_error("Loading failed.");
+			}
+		});
+	}
+
 	//Make a "Load< T >" behave like a "T const *":
 	explicit operator bool() { return value != nullptr; }
 	T const &operator*() { return *value; }
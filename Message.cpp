@@ -0,0 +1,56 @@
+#include "Message.hpp"
+
+#include <iostream>
+
+MessageWriter::MessageWriter(Connection &connection_, uint8_t type) : connection(connection_), start(connection_.send_buffer.size()) {
+	char header[Message::HeaderSize] = { char(type), 0, 0, 0 };
+	connection.send_buffer.append(header, Message::HeaderSize);
+}
+
+MessageWriter::~MessageWriter() {
+	RingBuffer &buffer = connection.send_buffer;
+	assert(start + Message::HeaderSize <= buffer.size() && "send_buffer was sent while a message was being written");
+	size_t size = buffer.size() - start - Message::HeaderSize;
+	if (size > Message::MaxSize) {
+		std::cerr << "[MessageWriter] message of " << size << " bytes is too long to send; dropping it." << std::endl;
+		buffer.truncate(start); //(nothing after 'start' has been sent, so it can be trimmed off the back)
+		return;
+	}
+	buffer[start + 1] = char(size & 0xff);
+	buffer[start + 2] = char((size >> 8) & 0xff);
+	buffer[start + 3] = char((size >> 16) & 0xff);
+}
+
+bool MessageDispatcher::dispatch(Connection *connection) const {
+	RingBuffer &buffer = connection->recv_buffer;
+	while (buffer.size() >= Message::HeaderSize) {
+		uint8_t type = uint8_t(buffer[0]);
+		uint32_t size = uint32_t(uint8_t(buffer[1]))
+		              | (uint32_t(uint8_t(buffer[2])) << 8)
+		              | (uint32_t(uint8_t(buffer[3])) << 16);
+
+		if (!handlers[type] || size > max_size) {
+			if (!handlers[type]) {
+				std::cerr << "[MessageDispatcher] message of unknown type " << int(type) << "; disconnecting." << std::endl;
+			} else {
+				std::cerr << "[MessageDispatcher] message of " << size << " bytes is longer than the limit of " << max_size << "; disconnecting." << std::endl;
+			}
+			buffer.clear();
+			connection->close();
+			return false;
+		}
+
+		if (buffer.size() < Message::HeaderSize + size) break; //wait for the rest
+
+		MessageView message;
+		message.type = type;
+		message.size = size;
+		message.data = buffer.contiguous(Message::HeaderSize + size) + Message::HeaderSize;
+		handlers[type](connection, message);
+
+		//(handler may have closed the connection, which leaves recv_buffer alone)
+		buffer.consume(Message::HeaderSize + size);
+		if (!*connection) return false;
+	}
+	return true;
+}
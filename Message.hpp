@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Connection.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+//Framed messages over a Connection.
+// Each message is a 4-byte header -- a type byte and a 24-bit little-endian payload length -- followed by the payload.
+//
+//Sending writes straight into the connection's send_buffer:
+//
+//	{
+//		MessageWriter message(connection, MessagePaddle);
+//		message.write(paddle_x);
+//	} //(length gets filled in when 'message' goes out of scope)
+//
+//Receiving calls a handler for each complete message in recv_buffer:
+//
+//	MessageDispatcher dispatcher;
+//	dispatcher.handlers[MessagePaddle] = [&](Connection *c, MessageView const &message) {
+//		message.read(0, &paddle_x);
+//	};
+//	...
+//	//in the poll callback, on Connection::OnRecv:
+//	dispatcher.dispatch(connection);
+
+namespace Message {
+	constexpr uint32_t HeaderSize = 4;
+	constexpr uint32_t MaxSize = 0xffffff; //largest payload a header can describe
+}
+
+//A received message; 'data' points into the connection's recv_buffer, so it is only valid during the handler call:
+struct MessageView {
+	uint8_t type;
+	uint32_t size; //payload bytes
+	char const *data; //payload
+
+	//copy a value out of the payload (payloads aren't aligned, so don't cast 'data'); returns false if it would read past the end:
+	template< typename T >
+	bool read(uint32_t offset, T *t) const {
+		if (offset > size || size - offset < sizeof(T)) return false;
+		std::memcpy(t, data + offset, sizeof(T));
+		return true;
+	}
+};
+
+//Appends one message to a connection's send_buffer; the header's length is filled in on destruction:
+// (finish the message before the connection is next polled)
+struct MessageWriter {
+	MessageWriter(Connection &connection, uint8_t type);
+	~MessageWriter();
+	MessageWriter(MessageWriter const &) = delete;
+
+	template< typename T >
+	void write(T const &t) {
+		write_raw(&t, sizeof(T));
+	}
+	void write_raw(void const *data, size_t size) {
+		connection.send_buffer.append(data, size);
+	}
+
+	Connection &connection;
+	size_t start; //index in send_buffer of the header
+};
+
+//Calls handlers for complete messages, looked up by type:
+struct MessageDispatcher {
+	typedef std::function< void(Connection *, MessageView const &) > Handler;
+	Handler handlers[256];
+
+	//messages longer than this are treated as a broken stream:
+	uint32_t max_size = Message::MaxSize;
+
+	//handle (and consume) every complete message at the front of the connection's recv_buffer:
+	// returns false -- after closing the connection -- if a message had no handler or was too long.
+	// (a partial message at the end is left in recv_buffer for next time)
+	bool dispatch(Connection *connection) const;
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include "Message.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+//Message schemas describe a message struct's fields at compile time, so encoders and decoders
+// get generated from templates (no virtual calls, no runtime type information):
+//
+//	struct ChatMessage {
+//		static constexpr uint8_t Type = 'c';
+//		uint32_t player;
+//		std::string text;
+//		typedef MessageSchema<
+//			MESSAGE_FIELD(&ChatMessage::player),
+//			MESSAGE_FIELD(&ChatMessage::text)
+//		> Schema;
+//	};
+//
+//	send_message(connection, ChatMessage{ 3, "hi" });
+//	set_message_handler< ChatMessage >(dispatcher, [](Connection *c, ChatMessage const &chat) { ... });
+//
+//Fields are packed in order with no padding:
+// - arithmetic and enum types are copied as-is (so both ends need the same byte order -- everything we ship on is little-endian)
+// - bool is one byte (also in std::vector< bool >)
+// - std::string and std::vector< T > are a uint32_t count followed by the elements
+// - any struct with a Schema typedef is its fields, so schemas can nest
+
+//Reads fields out of a received message's payload, checking bounds as it goes:
+struct MessageReader {
+	MessageReader(MessageView const &view_) : view(view_) { }
+	MessageView const &view;
+	uint32_t offset = 0;
+
+	uint32_t remaining() const { return view.size - offset; }
+	bool read_raw(void *data, size_t size) {
+		if (size > remaining()) return false;
+		std::memcpy(data, view.data + offset, size);
+		offset += uint32_t(size);
+		return true;
+	}
+};
+
+//MessageCodec< T > knows how to write and read a T:
+// MinSize -- fewest bytes a T can encode to
+// size(t) -- bytes t encodes to
+// encode(writer, t) / decode(reader, &t) -- decode returns false if the payload is too short or malformed
+template< typename T, typename Enable = void >
+struct MessageCodec;
+
+template< typename T >
+struct MessageCodec< T, typename std::enable_if< (std::is_arithmetic< T >::value || std::is_enum< T >::value) && !std::is_same< T, bool >::value >::type > {
+	static constexpr uint32_t MinSize = sizeof(T);
+	static size_t size(T const &) { return sizeof(T); }
+	static void encode(MessageWriter &writer, T const &t) { writer.write(t); }
+	static bool decode(MessageReader &reader, T *t) { return reader.read_raw(t, sizeof(T)); }
+};
+
+template< >
+struct MessageCodec< bool > {
+	static constexpr uint32_t MinSize = 1;
+	static size_t size(bool const &) { return 1; }
+	static void encode(MessageWriter &writer, bool const &b) { writer.write(uint8_t(b ? 1 : 0)); }
+	static bool decode(MessageReader &reader, bool *b) {
+		uint8_t byte;
+		if (!reader.read_raw(&byte, 1) || byte > 1) return false;
+		*b = (byte == 1);
+		return true;
+	}
+};
+
+//elements that encode to nothing (structs with an empty Schema) don't use up payload, so their counts get a fixed limit:
+constexpr uint32_t MessageMaxZeroSizeCount = 0x10000;
+
+//helper for counts in front of variable-length fields:
+// (rejects counts that couldn't possibly fit in the rest of the payload, so a bad count can't cause a huge allocation)
+inline bool decode_message_count(MessageReader &reader, uint32_t min_element_size, uint32_t *count) {
+	if (!reader.read_raw(count, sizeof(uint32_t))) return false;
+	if (min_element_size == 0) return *count <= MessageMaxZeroSizeCount;
+	return *count <= reader.remaining() / min_element_size;
+}
+
+template< >
+struct MessageCodec< std::string > {
+	static constexpr uint32_t MinSize = sizeof(uint32_t);
+	static size_t size(std::string const &s) { return sizeof(uint32_t) + s.size(); }
+	static void encode(MessageWriter &writer, std::string const &s) {
+		writer.write(uint32_t(s.size()));
+		writer.write_raw(s.data(), s.size());
+	}
+	static bool decode(MessageReader &reader, std::string *s) {
+		uint32_t count;
+		if (!decode_message_count(reader, 1, &count)) return false;
+		s->assign(reader.view.data + reader.offset, count);
+		reader.offset += count;
+		return true;
+	}
+};
+
+template< typename T >
+struct MessageCodec< std::vector< T > > {
+	//vectors of plain numbers are copied in one go:
+	typedef std::integral_constant< bool, std::is_arithmetic< T >::value > Bulk;
+
+	static constexpr uint32_t MinSize = sizeof(uint32_t);
+	static size_t size(std::vector< T > const &v) { return size(v, Bulk()); }
+	static void encode(MessageWriter &writer, std::vector< T > const &v) { encode(writer, v, Bulk()); }
+	static bool decode(MessageReader &reader, std::vector< T > *v) {
+		uint32_t count;
+		if (!decode_message_count(reader, MessageCodec< T >::MinSize, &count)) return false;
+		return decode(reader, count, v, Bulk());
+	}
+
+	//internals:
+	static size_t size(std::vector< T > const &v, std::true_type) {
+		return sizeof(uint32_t) + v.size() * sizeof(T);
+	}
+	static size_t size(std::vector< T > const &v, std::false_type) {
+		size_t total = sizeof(uint32_t);
+		for (auto const &t : v) total += MessageCodec< T >::size(t);
+		return total;
+	}
+	static void encode(MessageWriter &writer, std::vector< T > const &v, std::true_type) {
+		writer.write(uint32_t(v.size()));
+		writer.write_raw(v.data(), v.size() * sizeof(T));
+	}
+	static void encode(MessageWriter &writer, std::vector< T > const &v, std::false_type) {
+		writer.write(uint32_t(v.size()));
+		for (auto const &t : v) MessageCodec< T >::encode(writer, t);
+	}
+	static bool decode(MessageReader &reader, uint32_t count, std::vector< T > *v, std::true_type) {
+		v->resize(count);
+		return reader.read_raw(v->data(), count * sizeof(T));
+	}
+	static bool decode(MessageReader &reader, uint32_t count, std::vector< T > *v, std::false_type) {
+		v->resize(count);
+		for (auto &t : *v) {
+			if (!MessageCodec< T >::decode(reader, &t)) return false;
+		}
+		return true;
+	}
+};
+
+//std::vector< bool > packs its bits, so it gets a byte per element like bool does:
+template< >
+struct MessageCodec< std::vector< bool > > {
+	static constexpr uint32_t MinSize = sizeof(uint32_t);
+	static size_t size(std::vector< bool > const &v) { return sizeof(uint32_t) + v.size(); }
+	static void encode(MessageWriter &writer, std::vector< bool > const &v) {
+		writer.write(uint32_t(v.size()));
+		for (bool b : v) MessageCodec< bool >::encode(writer, b);
+	}
+	static bool decode(MessageReader &reader, std::vector< bool > *v) {
+		uint32_t count;
+		if (!decode_message_count(reader, MessageCodec< bool >::MinSize, &count)) return false;
+		v->resize(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			bool b;
+			if (!MessageCodec< bool >::decode(reader, &b)) return false;
+			(*v)[i] = b;
+		}
+		return true;
+	}
+};
+
+//structs with a Schema are encoded field-by-field:
+template< typename T >
+struct MessageSchemaVoid { typedef void type; };
+
+template< typename T >
+struct MessageCodec< T, typename MessageSchemaVoid< typename T::Schema >::type > {
+	static constexpr uint32_t MinSize = T::Schema::MinSize;
+	static size_t size(T const &t) { return T::Schema::size(t); }
+	static void encode(MessageWriter &writer, T const &t) { T::Schema::encode(writer, t); }
+	static bool decode(MessageReader &reader, T *t) { return T::Schema::decode(reader, t); }
+};
+
+//One field of a message struct, named by member pointer:
+// (use MESSAGE_FIELD(&Struct::member) rather than spelling out the member pointer's type)
+template< typename MemberPointer >
+struct MessageMemberTraits;
+
+template< typename S, typename T >
+struct MessageMemberTraits< T S::* > {
+	typedef S Struct;
+	typedef T Type;
+};
+
+template< typename MemberPointer, MemberPointer Member >
+struct MessageField {
+	typedef typename MessageMemberTraits< MemberPointer >::Struct Struct;
+	typedef typename MessageMemberTraits< MemberPointer >::Type Type;
+
+	static constexpr uint32_t MinSize = MessageCodec< Type >::MinSize;
+	static size_t size(Struct const &s) { return MessageCodec< Type >::size(s.*Member); }
+	static void encode(MessageWriter &writer, Struct const &s) { MessageCodec< Type >::encode(writer, s.*Member); }
+	static bool decode(MessageReader &reader, Struct *s) { return MessageCodec< Type >::decode(reader, &(s->*Member)); }
+};
+
+#define MESSAGE_FIELD(member) MessageField< decltype(member), member >
+
+//A message struct's fields, in the order they are sent:
+template< typename... Fields >
+struct MessageSchema;
+
+template< >
+struct MessageSchema< > {
+	static constexpr uint32_t MinSize = 0;
+	template< typename S > static size_t size(S const &) { return 0; }
+	template< typename S > static void encode(MessageWriter &, S const &) { }
+	template< typename S > static bool decode(MessageReader &, S *) { return true; }
+};
+
+template< typename First, typename... Rest >
+struct MessageSchema< First, Rest... > {
+	static constexpr uint32_t MinSize = First::MinSize + MessageSchema< Rest... >::MinSize;
+	template< typename S > static size_t size(S const &s) {
+		return First::size(s) + MessageSchema< Rest... >::size(s);
+	}
+	template< typename S > static void encode(MessageWriter &writer, S const &s) {
+		First::encode(writer, s);
+		MessageSchema< Rest... >::encode(writer, s);
+	}
+	template< typename S > static bool decode(MessageReader &reader, S *s) {
+		return First::decode(reader, s) && MessageSchema< Rest... >::decode(reader, s);
+	}
+};
+
+//Append message 'm' (of a struct with 'Type' and 'Schema') to a connection's send_buffer:
+template< typename M >
+void send_message(Connection &connection, M const &m) {
+	size_t size = M::Schema::size(m);
+	connection.send_buffer.reserve(Message::HeaderSize + size); //(so the fields don't grow the buffer one at a time)
+	MessageWriter writer(connection, M::Type);
+	M::Schema::encode(writer, m);
+}
+
+//Decode a received message; returns false if the payload doesn't match M's schema:
+template< typename M >
+bool decode_message(MessageView const &view, M *m) {
+	MessageReader reader(view);
+	return M::Schema::decode(reader, m) && reader.remaining() == 0;
+}
+
+//Have 'dispatcher' decode messages of type M::Type and call handler(Connection *, M const &) with them:
+// (malformed messages close the connection)
+template< typename M, typename Handler >
+void set_message_handler(MessageDispatcher &dispatcher, Handler handler) {
+	dispatcher.handlers[M::Type] = [handler](Connection *connection, MessageView const &view) {
+		M m;
+		if (!decode_message(view, &m)) {
+			std::cerr << "[set_message_handler] malformed message of type " << int(view.type) << "; disconnecting." << std::endl;
+			connection->close();
+			return;
+		}
+		handler(connection, m);
+	};
+}
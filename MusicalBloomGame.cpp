@@ -9,8 +9,7 @@ MusicalBloom::MusicalBloomGame::MusicalBloomGame()
 
 uint32_t MusicalBloom::MusicalBloomGame::increment_sequence()
 {
-    //uint32_t next_cube = (uint32_t)(rand() % (int)cubes.size());
-    uint32_t next_cube = (uint32_t)(rand() % 4);
+    uint32_t next_cube = (uint32_t)(rand() % (int)cubes.size());
     sequence.push_back(next_cube);
     return next_cube;
 };
@@ -49,7 +48,21 @@ void MusicalBloom::MusicalBloomGame::deactivate_cube(uint32_t cube_index)
 
 bool MusicalBloom::MusicalBloomGame::is_valid()
 {
-    return cubes.size() == sounds.size();
+    return cubes.size() >= sounds.size();
+};
+
+std::shared_ptr< Sound::PlayingSample > MusicalBloom::MusicalBloomGame::play_cube_sound(uint32_t cube_index, glm::vec3 const &position, uint64_t start)
+{
+    if (cube_index < sounds.size())
+    {
+        return sounds[cube_index]->play_at(start, position, 1.0f, Sound::Once);
+    }
+
+    // Walk up a major pentatonic scale starting from C5 for the extra cubes
+    static const float pentatonic[5] = { 0.0f, 2.0f, 4.0f, 7.0f, 9.0f };
+    uint32_t step = cube_index - (uint32_t)sounds.size();
+    float semitones = 3.0f + pentatonic[step % 5] + 12.0f * (float)(step / 5);
+    return synth.play_at(start, Sound::Synth::note_frequency(semitones), position, 1.0f, 0.5f);
 };
 
 uint32_t MusicalBloom::MusicalBloomGame::get_score()
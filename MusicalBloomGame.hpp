@@ -37,15 +37,21 @@ namespace MusicalBloom
         // Sets a specific cube not to be active
         void deactivate_cube(uint32_t cube_index);
 
-        // Returns true if the number of cubes and the numeber of sounds are equal
+        // Returns true if there is a cube for every sound (cubes past the
+        // end of sounds get a synthesized note instead)
         bool is_valid();
 
+        // Plays the sound for a cube at audio clock time 'start' (0 plays it right away)
+        std::shared_ptr< Sound::PlayingSample > play_cube_sound(uint32_t cube_index, glm::vec3 const &position, uint64_t start = 0);
+
         // Returns the max size of sequence they made it past
         uint32_t get_score();
 
         // Cubes and sounds managed by the game
         std::vector<const Sound::Sample*> sounds;
         std::vector<Cube> cubes;
+        // Instrument for cubes that don't have a sound
+        Sound::Synth synth;
         uint32_t currentCube = 0;
 
         // The current sequence that the player has to repeat back
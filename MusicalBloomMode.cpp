@@ -36,20 +36,21 @@ Load< GLuint > musical_bloom_meshes_for_highlight_test_program(LoadTagDefault, [
 });
 
 // Sounds from: https://freesound.org/people/DANMITCH3LL/sounds/
-Load< Sound::Sample > xylophone_a(LoadTagDefault, [](){
-        return new Sound::Sample(data_path("xylophone-a.wav"));
+// (decoded on background threads while meshes and shaders load)
+Load< Sound::Sample > xylophone_a(LoadTagInit, LoadTagLate, [](){
+        return Sound::Sample::load_async(data_path("xylophone-a.wav"), Sound::Sample::Int16);
 });
 
-Load< Sound::Sample > xylophone_c(LoadTagDefault, [](){
-        return new Sound::Sample(data_path("xylophone-c.wav"));
+Load< Sound::Sample > xylophone_c(LoadTagInit, LoadTagLate, [](){
+        return Sound::Sample::load_async(data_path("xylophone-c.wav"), Sound::Sample::Int16);
 });
 
-Load< Sound::Sample > xylophone_d(LoadTagDefault, [](){
-        return new Sound::Sample(data_path("xylophone-d1.wav"));
+Load< Sound::Sample > xylophone_d(LoadTagInit, LoadTagLate, [](){
+        return Sound::Sample::load_async(data_path("xylophone-d1.wav"), Sound::Sample::Int16);
 });
 
-Load< Sound::Sample > xylophone_e(LoadTagDefault, [](){
-        return new Sound::Sample(data_path("xylophone-e1.wav"));
+Load< Sound::Sample > xylophone_e(LoadTagInit, LoadTagLate, [](){
+        return Sound::Sample::load_async(data_path("xylophone-e1.wav"), Sound::Sample::Int16);
 });
 
 MusicalBloom::MusicalBloomMode::MusicalBloomMode() {
@@ -169,6 +170,22 @@ void MusicalBloom::MusicalBloomMode::play_sequence(float elapsed)
     // Reduce the timer
     time_to_next_highlight -= elapsed;
 
+    // Schedule the upcoming note on the audio clock, so its onset is
+    // sample-accurate instead of depending on when frames happen to land
+    // (only one note is scheduled at a time, so pausing can cancel it)
+    if (!note_scheduled && sequence_pos < game.sequence.size())
+    {
+        if (!note_anchored)
+        {
+            // First note since the round started or play resumed
+            note_start = Sound::audio_clock() + Sound::seconds_to_samples(time_to_next_highlight);
+            note_anchored = true;
+        }
+        uint32_t cube_index = game.sequence[sequence_pos];
+        next_note = game.play_cube_sound(cube_index, camera->transform->position, note_start);
+        note_scheduled = true;
+    }
+
     if (time_to_next_highlight <= 0.0f)
     {
         if (sequence_pos < game.sequence.size())
@@ -179,9 +196,13 @@ void MusicalBloom::MusicalBloomMode::play_sequence(float elapsed)
             reset_all_cubes();
             
             highlight_cube(cube_index);
-            game.sounds[cube_index]->play(camera->transform->position, 1.0f, Sound::Once);
+            // (the note lands now; the next one gets scheduled on the next call,
+            //  a fixed interval after this one so frame timing doesn't add up)
+            next_note.reset();
+            note_scheduled = false;
+            note_start += Sound::seconds_to_samples(time_between_highlights);
             sequence_pos++;
-            time_to_next_highlight = time_between_highlights;
+            time_to_next_highlight += time_between_highlights;
         }
         else
         {
@@ -192,6 +213,7 @@ void MusicalBloom::MusicalBloomMode::play_sequence(float elapsed)
                 // The sequence stops playing and we reset the counter for next time
                 playing_sequence = false;
                 sequence_pos = 0;
+                note_anchored = false;
                 time_to_next_highlight = time_between_rounds;
             }
         }
@@ -213,6 +235,11 @@ bool MusicalBloom::MusicalBloomMode::handle_event(SDL_Event const &evt, glm::uve
 			show_pause_menu();
 			return true;
 		}
+        if (evt.key.keysym.scancode == SDL_SCANCODE_F1) {
+            //dump audio callback timing (useful for tuning the mix block size and voice budget):
+            Sound::dump_stats(std::cout);
+            return true;
+        }
     }
 
     // Ignore all keys, but the pause button if we are not
@@ -226,22 +253,22 @@ bool MusicalBloom::MusicalBloomMode::handle_event(SDL_Event const &evt, glm::uve
 		if (evt.key.keysym.scancode == SDL_SCANCODE_1) {
             std::cout << "DEBUG:: " << "Player said: " << 1 << std::endl;
             highlight_cube(0);
-            game.sounds[0]->play(camera->transform->position, 1.0f, Sound::Once);
+            game.play_cube_sound(0, camera->transform->position);
 			return true;
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_2) {
             std::cout << "DEBUG:: " << "Player said: " << 2 << std::endl;
             highlight_cube(1);
-            game.sounds[1]->play(camera->transform->position, 1.0f, Sound::Once);
+            game.play_cube_sound(1, camera->transform->position);
 			return true;
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_3) {
             std::cout << "DEBUG:: " << "Player said: " << 3 << std::endl;
             highlight_cube(2);
-            game.sounds[2]->play(camera->transform->position, 1.0f, Sound::Once);
+            game.play_cube_sound(2, camera->transform->position);
 			return true;
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_4) {
             std::cout << "DEBUG:: " << "Player said: " << 4 << std::endl;
             highlight_cube(3);
-            game.sounds[3]->play(camera->transform->position, 1.0f, Sound::Once);
+            game.play_cube_sound(3, camera->transform->position);
 			return true;
 		}
 	}
@@ -282,6 +309,7 @@ void MusicalBloom::MusicalBloomMode::update(float elapsed)
     {
         std::cout << "DEBUG:: Starting round" << std::endl;
         round_started = true;
+        note_anchored = false;
 
         // Add a number to the current sequence
         game.increment_sequence();
@@ -351,6 +379,17 @@ void MusicalBloom::MusicalBloomMode::draw(glm::uvec2 const &drawable_size)
 };
 
 void MusicalBloom::MusicalBloomMode::show_pause_menu() {
+	//cancel the upcoming sequence note, unless it has already started (it is re-scheduled when the sequence resumes):
+	if (next_note) {
+		if (next_note->start >= Sound::audio_clock()) {
+			next_note->stop();
+			note_scheduled = false;
+		}
+		next_note.reset();
+	}
+	//(notes after a pause are timed from when play resumes)
+	note_anchored = false;
+
 	std::shared_ptr< MenuMode > menu = std::make_shared< MenuMode >();
 
 	std::shared_ptr< Mode > game = shared_from_this();
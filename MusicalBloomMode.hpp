@@ -75,6 +75,13 @@ namespace MusicalBloom
 
 
         std::shared_ptr< Sound::PlayingSample > current_sound;
+        // Sequence note scheduled on the audio clock but not highlighted yet (if any)
+        std::shared_ptr< Sound::PlayingSample > next_note;
+        bool note_scheduled = false;
+        // Audio clock sample the scheduled (or last) note starts at; the next note starts
+        // time_between_highlights after it, unless a round just started or play just resumed
+        uint64_t note_start = 0;
+        bool note_anchored = false;
     };
 
 }
\ No newline at end of file
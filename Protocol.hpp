@@ -0,0 +1,21 @@
+#pragma once
+
+#include "MessageSchema.hpp"
+
+//Messages sent between clients and the server.
+// (each has a unique 'Type' byte and a 'Schema' listing the fields that get sent)
+
+//client -> server, once on connect:
+struct HelloMessage {
+	static constexpr uint8_t Type = 'h';
+	typedef MessageSchema< > Schema;
+};
+
+//client -> server, whenever the player's paddle moves:
+struct StateMessage {
+	static constexpr uint8_t Type = 's';
+	float paddle_x = 0.0f;
+	typedef MessageSchema<
+		MESSAGE_FIELD(&StateMessage::paddle_x)
+	> Schema;
+};
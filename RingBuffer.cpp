@@ -0,0 +1,77 @@
+#include "RingBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+void RingBuffer::append(void const *data_, size_t size) {
+	reserve(size);
+	char const *data = reinterpret_cast< char const * >(data_);
+	Span spans[2];
+	size_t span_count = free_spans(spans);
+	for (size_t s = 0; s < span_count && size > 0; ++s) {
+		size_t amount = std::min(size, spans[s].size);
+		std::memcpy(spans[s].data, data, amount);
+		data += amount;
+		size -= amount;
+		count += amount;
+	}
+	assert(size == 0);
+}
+
+void RingBuffer::peek(size_t offset, void *data_, size_t size) const {
+	assert(offset + size <= count);
+	if (size == 0) return;
+	char *data = reinterpret_cast< char * >(data_);
+	size_t start = (head + offset) & (storage.size() - 1);
+	size_t first = std::min(size, storage.size() - start);
+	std::memcpy(data, storage.data() + start, first);
+	std::memcpy(data + first, storage.data(), size - first);
+}
+
+void RingBuffer::reserve(size_t size) {
+	if (storage.size() - count >= size) return;
+
+	size_t new_capacity = std::max< size_t >(storage.size(), 64);
+	while (new_capacity - count < size) new_capacity *= 2;
+
+	//copy the data to the front of the new storage:
+	std::vector< char > new_storage(new_capacity);
+	peek(0, new_storage.data(), count);
+	storage.swap(new_storage);
+	head = 0;
+}
+
+char *RingBuffer::contiguous(size_t size) {
+	assert(size <= count);
+	if (storage.empty()) return nullptr;
+	if (head + size > storage.size()) {
+		//rotate so the data starts at the front of storage:
+		std::rotate(storage.begin(), storage.begin() + head, storage.end());
+		head = 0;
+	}
+	return storage.data() + head;
+}
+
+size_t RingBuffer::data_spans(Span spans[2]) {
+	if (count == 0) return 0;
+	size_t first = std::min(count, storage.size() - head);
+	spans[0].data = storage.data() + head;
+	spans[0].size = first;
+	if (first == count) return 1;
+	spans[1].data = storage.data();
+	spans[1].size = count - first;
+	return 2;
+}
+
+size_t RingBuffer::free_spans(Span spans[2]) {
+	size_t free = storage.size() - count;
+	if (free == 0) return 0;
+	size_t tail = (head + count) & (storage.size() - 1);
+	size_t first = std::min(free, storage.size() - tail);
+	spans[0].data = storage.data() + tail;
+	spans[0].size = first;
+	if (first == free) return 1;
+	spans[1].data = storage.data();
+	spans[1].size = free - first;
+	return 2;
+}
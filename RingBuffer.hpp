@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+//"RingBuffer" is a growable byte queue for socket data:
+// appending writes at the back, consuming drops bytes from the front,
+// and neither one moves the bytes that stay in the buffer.
+//Capacity is always a power of two, so wrapping is a mask.
+struct RingBuffer {
+	//a run of contiguous bytes inside the buffer:
+	struct Span {
+		char *data;
+		size_t size;
+	};
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	size_t capacity() const { return storage.size(); }
+
+	//byte 'i' from the front:
+	char &operator[](size_t i) {
+		assert(i < count);
+		return storage[(head + i) & (storage.size() - 1)];
+	}
+	char const &operator[](size_t i) const {
+		assert(i < count);
+		return storage[(head + i) & (storage.size() - 1)];
+	}
+
+	//append bytes to the back, growing if needed:
+	void append(void const *data, size_t size);
+	//copy 'size' bytes starting 'offset' bytes from the front into 'data':
+	void peek(size_t offset, void *data, size_t size) const;
+	//drop bytes from the front:
+	void consume(size_t size) {
+		assert(size <= count);
+		count -= size;
+		//(an empty buffer restarts at the front, so small messages don't wrap)
+		head = (count == 0 ? 0 : (head + size) & (storage.size() - 1));
+	}
+	//drop bytes from the back, keeping the first 'size':
+	void truncate(size_t size) {
+		assert(size <= count);
+		count = size;
+	}
+	void clear() {
+		head = 0;
+		count = 0;
+	}
+
+	//make sure at least 'size' bytes can be appended without growing:
+	void reserve(size_t size);
+
+	//the first 'size' bytes as one contiguous run:
+	// (only moves data if those bytes happen to wrap around the end of storage)
+	char *contiguous(size_t size);
+
+	//the bytes in the buffer (front to back), as up to two spans; returns the span count:
+	// (e.g., to hand to writev/sendmsg, then consume() what was sent)
+	size_t data_spans(Span spans[2]);
+	//the free space after the data, as up to two spans; returns the span count:
+	// (e.g., to hand to readv/recvmsg, then commit() what was read)
+	size_t free_spans(Span spans[2]);
+	//mark 'size' bytes written into the free spans as data:
+	void commit(size_t size) {
+		assert(count + size <= storage.size());
+		count += size;
+	}
+
+	//internals:
+	std::vector< char > storage;
+	size_t head = 0; //index in storage of the front byte
+	size_t count = 0; //bytes in the buffer
+};
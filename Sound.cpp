@@ -1,23 +1,49 @@
 #include "Sound.hpp"
+#include "data_path.hpp"
+#include "WorkerPool.hpp"
 
 #include <SDL.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <list>
+#include <mutex>
 #include <string>
+#include <thread>
 
 namespace Sound {
 
 Ramp< float > volume = Ramp< float >(1.0f);
 struct Listener listener;
+std::vector< Bus > buses(1);
+bool use_sample_cache = true;
+uint32_t max_voices = 32;
+uint32_t max_playing_samples = 256;
 
 namespace {
 //local functions + data:
 
-//helpers for advancing ramps:
-constexpr const float RampStep = float(MixSamples) / float(AudioRate);
-void step_position_ramp(Ramp< glm::vec3 > &ramp) {
+//samples per mixed block (see set_mix_samples):
+uint32_t mix_samples = DefaultMixSamples;
+
+//helpers for advancing ramps by 'RampStep' seconds (one mix block):
+void step_position_ramp(Ramp< glm::vec3 > &ramp, float RampStep) {
 	if (ramp.ramp < RampStep) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
@@ -26,7 +52,7 @@ void step_position_ramp(Ramp< glm::vec3 > &ramp) {
 		ramp.ramp -= RampStep;
 	}
 }
-void step_value_ramp(Ramp< float > &ramp) {
+void step_value_ramp(Ramp< float > &ramp, float RampStep) {
 	if (ramp.ramp < RampStep) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
@@ -35,7 +61,7 @@ void step_value_ramp(Ramp< float > &ramp) {
 		ramp.ramp -= RampStep;
 	}
 }
-void step_direction_ramp(Ramp< glm::vec3 > &ramp) {
+void step_direction_ramp(Ramp< glm::vec3 > &ramp, float RampStep) {
 	if (ramp.ramp < RampStep) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
@@ -67,141 +93,1098 @@ void step_direction_ramp(Ramp< glm::vec3 > &ramp) {
 	}
 }
 
-//helper to compute panning values given a listener and source:
-void compute_pan_from_listener_and_position(
-	glm::vec3 const &listener_position,
-	glm::vec3 const &listener_right,
-	glm::vec3 const &source_position,
-	float *volume_left, float *volume_right
-	) {
-	glm::vec3 to = source_position - listener_position;
-	float distance = glm::length(to);
-	//start by panning based on direction.
-	//note that for a LR fade to sound uniform, sound power (squared magnitude) should remain constant.
-	if (distance == 0.0f) {
-		*volume_left = *volume_right = std::sqrt(2.0f);
-	} else {
+//all currently playing samples:
+// (a vector rather than a list, so the per-block gather in mix_block walks contiguous memory)
+std::vector< std::shared_ptr< PlayingSample > > playing_samples;
+
+struct LR {
+	float l;
+	float r;
+};
+static_assert(sizeof(LR) == 8, "Sample is packed");
+
+//per-block panning info for each playing sample, used to decide which samples get mixed:
+struct VoiceInfo {
+	PlayingSample *source;
+	LR start_pan;
+	LR end_pan;
+	float importance; //priority * loudness over this block
+	uint32_t offset; //first sample in the block to mix into (non-zero for samples that start mid-block)
+	bool pending; //sample doesn't start until a later block
+};
+std::vector< VoiceInfo > voice_infos; //kept between callbacks so it only reallocates when the voice count grows
+
+//add 'count' samples of 'in' (converted to float and multiplied by 'scale') to 'out',
+// panning linearly from 'pan' in steps of 'pan_step':
+// (written without loop-carried state so the compiler can vectorize it)
+template< typename T >
+void mix_span(LR *out, T const *in, uint32_t count, LR pan, LR pan_step, float scale) {
+	for (uint32_t i = 0; i < count; ++i) {
+		float v = float(in[i]) * scale;
+		out[i].l += (pan.l + pan_step.l * float(i)) * v;
+		out[i].r += (pan.r + pan_step.r * float(i)) * v;
+	}
+}
+
+//sin(2 * pi * x), approximated without branches so it vectorizes (max error ~0.001):
+inline float fast_sin_cycles(float x) {
+	float t = x - std::floor(x + 0.5f); //t in [-0.5, 0.5)
+	float y = 8.0f * t - 16.0f * t * std::abs(t);
+	return 0.225f * (y * std::abs(y) - y) + y;
+}
+
+//------------------
+//Spatial state for all playing samples, gathered into arrays once per block so that
+// panning, attenuation and ramp stepping run as one pass without per-voice branches:
+struct VoiceBatch {
+	//position ramp:
+	std::vector< float > x, y, z; //current value
+	std::vector< float > tx, ty, tz; //target
+	std::vector< float > position_ramp; //seconds remaining
+	//volume ramp:
+	std::vector< float > volume, volume_target, volume_ramp;
+	//results (pan * volume at start and end of block):
+	std::vector< float > start_l, start_r, end_l, end_r;
+
+	void resize(size_t count) {
+		for (auto v : { &x, &y, &z, &tx, &ty, &tz, &position_ramp, &volume, &volume_target, &volume_ramp, &start_l, &start_r, &end_l, &end_r }) {
+			if (v->size() < count) v->resize(count);
+		}
+	}
+	//(so resize() doesn't allocate in the audio callback)
+	void reserve(size_t count) {
+		for (auto v : { &x, &y, &z, &tx, &ty, &tz, &position_ramp, &volume, &volume_target, &volume_ramp, &start_l, &start_r, &end_l, &end_r }) {
+			v->reserve(count);
+		}
+	}
+} voice_batch;
+
+//Listener state at one end of the block:
+struct ListenerFrame {
+	glm::vec3 position;
+	glm::vec3 right;
+	float volume;
+};
+
+//panning for 'count' sources at (x,y,z) heard by 'frame', scaled by source volume;
+// 'l' and 'r' get the result:
+//note that for a LR fade to sound uniform, sound power (squared magnitude) should remain constant.
+void compute_pans(ListenerFrame const &frame, float const *x, float const *y, float const *z, float const *volume, float *l, float *r, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i) {
+		float to_x = x[i] - frame.position.x;
+		float to_y = y[i] - frame.position.y;
+		float to_z = z[i] - frame.position.z;
+		float distance = std::sqrt(to_x * to_x + to_y * to_y + to_z * to_z);
+		float inv_distance = 1.0f / std::max(distance, 1.0e-20f);
+
 		//amt ranges from -1 (most left) to 1 (most right):
-		float amt = glm::dot(listener_right, to) / distance;
+		float amt = (frame.right.x * to_x + frame.right.y * to_y + frame.right.z * to_z) * inv_distance;
 		//turn into an angle from 0.0f (most left) to pi/2 (most right):
-		float ang = 0.5f * 3.1415926f * (0.5f * (amt + 1.0f));
-		*volume_right = std::sin(ang);
-		*volume_left = std::cos(ang);
+		// (std::sin/cos rather than fast_sin_cycles: it's only two calls per voice per block, and keeps the pan law exact)
+		float ang = 0.5f * 3.1415926f * (0.5f * (std::min(std::max(amt, -1.0f), 1.0f) + 1.0f));
+		float pan_r = std::sin(ang);
+		float pan_l = std::cos(ang);
 
 		//squared distance attenuation is realistic if there are no walls,
 		// but I'm going to use linear because it's sounds better to me.
 		// (feel free to change it, of course)
-		if (distance > 1.0f) {
-			*volume_left /= distance;
-			*volume_right /= distance;
+		float attenuation = 1.0f / std::max(distance, 1.0f);
+
+		//a source right at the listener plays equally loud on both sides:
+		float scale = frame.volume * volume[i];
+		l[i] = scale * (distance == 0.0f ? std::sqrt(2.0f) : pan_l * attenuation);
+		r[i] = scale * (distance == 0.0f ? std::sqrt(2.0f) : pan_r * attenuation);
+	}
+}
+
+//step 'count' ramps ('value' toward 'target' with 'ramp' seconds remaining) forward by 'step' seconds:
+// (same as step_value_ramp, but without branches)
+void step_ramps(float *value, float const *target, float *ramp, float step, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i) {
+		float amt = step / std::max(ramp[i], step); //1 if the ramp finishes this step
+		value[i] += (target[i] - value[i]) * amt;
+		ramp[i] = std::max(ramp[i] - step, 0.0f);
+	}
+}
+
+//write the next 'count' samples of a synthesized note to 'out' (does not advance 'voice.i'):
+void render_synth(PlayingSample &voice, float *out, uint32_t count) {
+	assert(!voice.sample);
+	Synth const &synth = voice.synth;
+
+	const float dt = 1.0f / float(AudioRate);
+	const float inc = voice.frequency * dt;
+	const float mod_inc = inc * synth.ratio;
+
+	//envelope pieces, as functions of time since note start:
+	const float t0 = float(voice.i) * dt;
+	const float inv_attack = 1.0f / std::max(synth.attack, dt);
+	const float inv_decay = 1.0f / std::max(synth.decay, dt);
+	const float inv_release = 1.0f / std::max(synth.release, dt);
+	const float release_t = float(voice.release_at) * dt;
+
+	//modulation depth decays exponentially; interpolate it linearly over the block:
+	const float index0 = synth.index * std::exp(-t0 / synth.brightness);
+	const float index1 = synth.index * std::exp(-(t0 + count * dt) / synth.brightness);
+	const float index_step = (index1 - index0) / float(std::max(count, 1U));
+
+	for (uint32_t i = 0; i < count; ++i) {
+		float t = t0 + dt * float(i);
+		//attack ramps up to 1; decay ramps down to sustain; taking the min of the two picks whichever is active:
+		float attack = std::min(t * inv_attack, 1.0f);
+		float decay = 1.0f - (1.0f - synth.sustain) * std::min(std::max((t - synth.attack) * inv_decay, 0.0f), 1.0f);
+		float release = 1.0f - std::min(std::max((t - release_t) * inv_release, 0.0f), 1.0f);
+		float env = std::min(attack, decay) * release;
+
+		float mod = fast_sin_cycles(voice.mod_phase + mod_inc * float(i));
+		float car = fast_sin_cycles(voice.phase + inc * float(i) + (index0 + index_step * float(i)) * mod);
+		out[i] = synth.gain * env * car;
+	}
+
+	voice.phase += inc * count;
+	voice.phase -= std::floor(voice.phase);
+	voice.mod_phase += mod_inc * count;
+	voice.mod_phase -= std::floor(voice.mod_phase);
+}
+
+//scratch space for rendering synthesized notes before mixing them:
+std::vector< float > synth_scratch;
+
+//per-bus mix buffers (MaxMixSamples apart):
+std::vector< LR > bus_mix;
+
+//time (in samples) of the start of the next block to mix:
+std::atomic< uint64_t > mix_clock(0);
+
+//advance a sample that isn't being mixed this block:
+void advance_virtual(PlayingSample &source, uint32_t offset) {
+	if (!source.sample) {
+		//synthesized notes just skip ahead (their oscillators stay continuous enough for an inaudible note):
+		source.i += std::min(mix_samples - offset, source.size - source.i);
+		return;
+	}
+
+	uint32_t size = source.size;
+	source.i += mix_samples - offset;
+	if (source.i >= size) {
+		if (source.loop) source.i %= size;
+		else source.i = size;
+	}
+}
+
+//mix one sample for this block into its bus's slice of 'bus_buffers' (using 'scratch' for synthesized notes):
+void mix_voice(VoiceInfo const &info, LR *bus_buffers, uint32_t bus_count, float *scratch) {
+	PlayingSample &source = *info.source;
+	LR *buffer = bus_buffers + size_t(std::min< uint32_t >(source.bus, bus_count - 1)) * MaxMixSamples;
+
+	LR pan_step;
+	pan_step.l = (info.end_pan.l - info.start_pan.l) / mix_samples;
+	pan_step.r = (info.end_pan.r - info.start_pan.r) / mix_samples;
+	LR pan;
+	pan.l = info.start_pan.l + pan_step.l * info.offset;
+	pan.r = info.start_pan.r + pan_step.r * info.offset;
+
+	uint32_t size = source.size;
+	assert(source.i < size);
+
+	//mix contiguous runs of sample data (split where the sample loops):
+	for (uint32_t at = info.offset; at < mix_samples; /* later */) {
+		uint32_t count = std::min(mix_samples - at, size - source.i);
+		LR pan_at;
+		pan_at.l = pan.l + pan_step.l * (at - info.offset);
+		pan_at.r = pan.r + pan_step.r * (at - info.offset);
+		if (!source.sample) {
+			render_synth(source, scratch, count);
+			mix_span(buffer + at, scratch, count, pan_at, pan_step, 1.0f);
+		} else if (source.sample->storage == Sample::Int16) {
+			mix_span(buffer + at, static_cast< int16_t const * >(source.sample->pcm) + source.i, count, pan_at, pan_step, 1.0f / 32768.0f);
+		} else {
+			mix_span(buffer + at, static_cast< float const * >(source.sample->pcm) + source.i, count, pan_at, pan_step, 1.0f);
+		}
+		at += count;
+
+		//update position in sample:
+		source.i += count;
+		if (source.i == size) {
+			if (source.loop) source.i = 0;
+			else break;
 		}
 	}
 }
 
-//list of all currently playing samples:
-std::list< std::shared_ptr< PlayingSample > > playing_samples;
+//------------------
+//multi-threaded mixing:
+// mix_parallel() shares the mixed samples between the audio thread and the pool's idle workers.
+// A job holds copies of the samples' playback state, so workers never touch playing_samples (or anything
+// the game thread changes): each claims copies one at a time from a shared counter and mixes them into its
+// own partial block. The audio thread keeps claiming until none are left, then waits (up to a deadline) for
+// workers to finish, and copies the advanced state back. A worker that misses the deadline has its partial
+// block dropped -- its samples are advanced without being heard, a brief gap in a few samples instead of an
+// underrun for the whole output -- and it sits out later blocks until it catches up.
+// The mixer has its own workers rather than using WorkerPool::shared(), since a block can't wait for a
+// sample decode or a crowd update that happens to be ahead of it in the shared queue.
 
-void mix_audio(void *, Uint8 *stream, int len) {
-	assert(stream); //should always have some audio buffer
+constexpr const uint32_t ParallelMixMinVoices = 16; //below this, threading costs more than it saves
+constexpr const float ParallelMixDeadline = 0.75f; //fraction of the block duration to wait for workers
+
+//values of MixJob::mixed_by besides worker indices:
+constexpr const uint32_t MixedByNobody = -1U;
+constexpr const uint32_t MixedByAudioThread = -2U;
+
+struct MixJob {
+	std::vector< PlayingSample > sources; //copies of the mixed samples
+	std::vector< VoiceInfo > voices; //(pointing at the copies)
+	std::unique_ptr< std::atomic< uint32_t >[] > mixed_by; //who mixed each voice
+	uint32_t mixed_by_size = 0;
+	uint32_t count = 0;
+	uint32_t buses = 0;
+	std::atomic< uint32_t > next{0};
+	uint32_t workers = 0; //workers still on this job (guarded by MixPool::mutex)
+};
+
+struct MixWorker {
+	std::thread thread;
+	uint32_t index = 0;
+	std::vector< LR > partial; //one MaxMixSamples slice per bus
+	std::vector< float > scratch;
+	//guarded by MixPool::mutex:
+	MixJob *job = nullptr; //job being worked on (nullptr when idle)
+	uint64_t posted = 0; //counts jobs given to this worker
+};
+
+struct MixPool {
+	std::mutex mutex;
+	std::condition_variable start_cv; //signalled when a job is posted
+	std::condition_variable done_cv; //signalled when a worker finishes a job
+	bool quit = false;
+	std::vector< std::unique_ptr< MixWorker > > workers;
+	//two jobs, so a block can be posted while a late worker is still on the previous one:
+	MixJob jobs[2];
 
-	struct LR {
-		float l;
-		float r;
+	void start(uint32_t count);
+	void stop();
+	bool idle() const {
+		for (auto const &w : workers) {
+			if (w->job) return false;
+		}
+		return true;
+	}
+	~MixPool() { stop(); }
+} mix_pool;
+
+//claim and mix voices from 'job' until none remain:
+void mix_claimed(MixJob &job, LR *buffer, float *scratch, uint32_t who) {
+	while (true) {
+		uint32_t v = job.next.fetch_add(1);
+		if (v >= job.count) break;
+		mix_voice(job.voices[v], buffer, job.buses, scratch);
+		job.mixed_by[v].store(who, std::memory_order_release);
+	}
+}
+
+void mix_worker(MixWorker *worker) {
+	uint64_t seen = 0; //(matches worker->posted, which starts at zero)
+	while (true) {
+		MixJob *job;
+		{ //wait for a job:
+			std::unique_lock< std::mutex > guard(mix_pool.mutex);
+			mix_pool.start_cv.wait(guard, [&](){ return mix_pool.quit || worker->posted != seen; });
+			if (mix_pool.quit) return;
+			seen = worker->posted;
+			job = worker->job;
+		}
+
+		for (uint32_t b = 0; b < job->buses; ++b) {
+			LR *partial = worker->partial.data() + size_t(b) * MaxMixSamples;
+			for (uint32_t s = 0; s < mix_samples; ++s) {
+				partial[s].l = 0.0f;
+				partial[s].r = 0.0f;
+			}
+		}
+		mix_claimed(*job, worker->partial.data(), worker->scratch.data(), worker->index);
+
+		{
+			std::lock_guard< std::mutex > guard(mix_pool.mutex);
+			worker->job = nullptr;
+			job->workers -= 1;
+		}
+		mix_pool.done_cv.notify_all();
+	}
+}
+
+void MixPool::start(uint32_t count) {
+	stop();
+	quit = false;
+	for (uint32_t i = 0; i < count; ++i) {
+		workers.emplace_back(new MixWorker);
+		MixWorker &worker = *workers.back();
+		worker.index = i;
+		worker.partial.resize(buses.size() * MaxMixSamples);
+		worker.scratch.resize(MaxMixSamples);
+		worker.thread = std::thread(mix_worker, &worker);
+	}
+}
+
+void MixPool::stop() {
+	{
+		std::lock_guard< std::mutex > guard(mutex);
+		quit = true;
+	}
+	start_cv.notify_all();
+	for (auto &w : workers) {
+		w->thread.join();
+	}
+	workers.clear();
+	for (auto &job : jobs) job.workers = 0;
+}
+
+//counts partial blocks dropped because a worker missed the deadline:
+std::atomic< uint64_t > late_partials{0};
+
+//mix 'voices' into 'buffer' with help from idle workers; returns false (having done nothing) if no worker is free:
+bool mix_parallel(LR *buffer, VoiceInfo const *voices, uint32_t count, std::chrono::steady_clock::time_point deadline) {
+	MixJob *job = nullptr;
+	{ //find a job no (late) worker is still using, and check that some worker is free to take it:
+		std::lock_guard< std::mutex > guard(mix_pool.mutex);
+		for (auto &j : mix_pool.jobs) {
+			if (j.workers == 0) job = &j;
+		}
+		bool any_idle = false;
+		for (auto const &w : mix_pool.workers) {
+			if (!w->job) any_idle = true;
+		}
+		if (!job || !any_idle) return false;
+	}
+
+	//copy the voices' state into the job:
+	// (no worker is on this job, so it can be filled without the lock)
+	job->sources.clear();
+	job->sources.reserve(count); //(so pointers into 'sources' stay put)
+	job->voices.assign(voices, voices + count);
+	for (uint32_t v = 0; v < count; ++v) {
+		job->sources.emplace_back(*voices[v].source);
+		job->voices[v].source = &job->sources.back();
+	}
+	if (job->mixed_by_size < count) {
+		job->mixed_by.reset(new std::atomic< uint32_t >[count]);
+		job->mixed_by_size = count;
+	}
+	for (uint32_t v = 0; v < count; ++v) {
+		job->mixed_by[v].store(MixedByNobody, std::memory_order_relaxed);
+	}
+	job->count = count;
+	job->buses = uint32_t(buses.size());
+	job->next = 0;
+
+	//hand the job to every idle worker:
+	std::vector< MixWorker * > &helpers = *[]() {
+		static std::vector< MixWorker * > list; //(audio thread only; avoids allocating each block)
+		return &list;
+	}();
+	helpers.clear();
+	{
+		std::lock_guard< std::mutex > guard(mix_pool.mutex);
+		for (auto &w : mix_pool.workers) {
+			if (w->job) continue; //still late on an earlier job
+			if (w->partial.size() < job->buses * MaxMixSamples) w->partial.resize(job->buses * MaxMixSamples); //(only allocates when buses are added)
+			w->job = job;
+			w->posted += 1;
+			job->workers += 1;
+			helpers.emplace_back(w.get());
+		}
+	}
+	mix_pool.start_cv.notify_all();
+
+	//the audio thread mixes too, directly into the output:
+	mix_claimed(*job, buffer, synth_scratch.data(), MixedByAudioThread);
+
+	//collect partial blocks from workers that finish in time:
+	std::vector< bool > &delivered = *[]() {
+		static std::vector< bool > list;
+		return &list;
+	}();
+	delivered.assign(mix_pool.workers.size(), false);
+	{
+		std::unique_lock< std::mutex > guard(mix_pool.mutex);
+		mix_pool.done_cv.wait_until(guard, deadline, [job](){ return job->workers == 0; });
+		for (MixWorker *w : helpers) {
+			if (w->job == job) {
+				late_partials.fetch_add(1, std::memory_order_relaxed);
+			} else {
+				delivered[w->index] = true;
+			}
+		}
+	}
+	//(delivered workers are idle, and only this thread posts jobs, so their partials can be read without the lock)
+	for (MixWorker *w : helpers) {
+		if (!delivered[w->index]) continue;
+		for (uint32_t b = 0; b < job->buses; ++b) {
+			LR *out = buffer + size_t(b) * MaxMixSamples;
+			LR const *partial = w->partial.data() + size_t(b) * MaxMixSamples;
+			for (uint32_t s = 0; s < mix_samples; ++s) {
+				out[s].l += partial[s].l;
+				out[s].r += partial[s].r;
+			}
+		}
+	}
+
+	//copy advanced playback state back to the real samples:
+	for (uint32_t v = 0; v < count; ++v) {
+		PlayingSample &source = *voices[v].source;
+		uint32_t who = job->mixed_by[v].load(std::memory_order_acquire);
+		if (who == MixedByAudioThread || (who < delivered.size() && delivered[who])) {
+			PlayingSample const &copy = job->sources[v];
+			source.i = copy.i;
+			source.phase = copy.phase;
+			source.mod_phase = copy.mod_phase;
+		} else {
+			//mixed by a late worker (whose partial was dropped), so just advance it:
+			advance_virtual(source, voices[v].offset);
+		}
+	}
+	return true;
+}
+
+//------------------
+//bus effects; each runs over a whole block of a bus's summed signal:
+
+void run_lowpass(Bus &bus, LR *data, uint32_t count) {
+	//one-pole: y += a * (x - y)
+	const float a = 1.0f - std::exp(-2.0f * 3.1415926f * bus.lowpass.cutoff / float(AudioRate));
+	float l = bus.lowpass_l;
+	float r = bus.lowpass_r;
+	for (uint32_t s = 0; s < count; ++s) {
+		l += a * (data[s].l - l);
+		r += a * (data[s].r - r);
+		data[s].l = l;
+		data[s].r = r;
+	}
+	bus.lowpass_l = l;
+	bus.lowpass_r = r;
+}
+
+void run_compressor(Bus &bus, LR *data, uint32_t count) {
+	Bus::Compressor const &c = bus.compressor;
+	//envelope smoothing, indexed by whether the signal is rising (so the loop has no branches):
+	const float rate[2] = {
+		1.0f - std::exp(-1.0f / (std::max(c.release, 1e-4f) * AudioRate)),
+		1.0f - std::exp(-1.0f / (std::max(c.attack, 1e-4f) * AudioRate))
 	};
-	static_assert(sizeof(LR) == 8, "Sample is packed");
-	assert(len == MixSamples * sizeof(LR)); //should always have the expected number of samples
+	const float inv_ratio = 1.0f / std::max(c.ratio, 1.0f);
+	const float threshold = std::max(c.threshold, 1e-6f);
+	float env = bus.envelope;
+	for (uint32_t s = 0; s < count; ++s) {
+		//peak envelope follower:
+		float peak = std::max(std::abs(data[s].l), std::abs(data[s].r));
+		env += rate[peak > env] * (peak - env);
+		//reduce gain above threshold (below it, over == threshold and gain is exactly 1):
+		float over = std::max(env, threshold);
+		float gain = (threshold + (over - threshold) * inv_ratio) / over;
+		data[s].l *= gain;
+		data[s].r *= gain;
+	}
+	bus.envelope = env;
+}
+
+//delay lengths (in samples) for the reverb, from the classic 'freeverb' tuning; right channel is spread a bit:
+constexpr const uint32_t ReverbCombLengths[4] = { 1557, 1617, 1491, 1422 };
+constexpr const uint32_t ReverbAllpassLengths[2] = { 556, 441 };
+constexpr const uint32_t ReverbStereoSpread = 23;
+
+//delay lines are run in contiguous spans up to the point where they wrap, so the inner loops don't check for wrapping:
+
+void run_comb(Bus::Delay &comb, float const *in, float *wet, uint32_t count, float damping, float room) {
+	float store = comb.store;
+	for (uint32_t s = 0; s < count; /* later */) {
+		uint32_t span = std::min(count - s, uint32_t(comb.data.size()) - comb.at);
+		float *line = comb.data.data() + comb.at;
+		for (uint32_t k = 0; k < span; ++k) {
+			float out = line[k];
+			store = out + damping * (store - out);
+			line[k] = in[s + k] + store * room;
+			wet[s + k] += out;
+		}
+		s += span;
+		comb.at += span;
+		if (comb.at == comb.data.size()) comb.at = 0;
+	}
+	comb.store = store;
+}
 
-	LR *buffer = reinterpret_cast< LR * >(stream);
+void run_allpass(Bus::Delay &ap, float *wet, uint32_t count) {
+	for (uint32_t s = 0; s < count; /* later */) {
+		uint32_t span = std::min(count - s, uint32_t(ap.data.size()) - ap.at);
+		float *line = ap.data.data() + ap.at;
+		for (uint32_t k = 0; k < span; ++k) {
+			float buffered = line[k];
+			line[k] = wet[s + k] + buffered * 0.5f;
+			wet[s + k] = buffered - wet[s + k];
+		}
+		s += span;
+		ap.at += span;
+		if (ap.at == ap.data.size()) ap.at = 0;
+	}
+}
+
+//scratch for reverb input and output:
+std::vector< float > reverb_dry, reverb_wet_l, reverb_wet_r;
+
+void run_reverb(Bus &bus, LR *data, uint32_t count) {
+	Bus::Reverb const &rv = bus.reverb;
+	if (bus.combs.empty()) {
+		//(first use on this bus; allocates delay lines)
+		for (uint32_t c = 0; c < 2; ++c) {
+			for (uint32_t len : ReverbCombLengths) {
+				bus.combs.emplace_back();
+				bus.combs.back().data.assign(len + c * ReverbStereoSpread, 0.0f);
+			}
+			for (uint32_t len : ReverbAllpassLengths) {
+				bus.allpasses.emplace_back();
+				bus.allpasses.back().data.assign(len + c * ReverbStereoSpread, 0.0f);
+			}
+		}
+	}
+	if (reverb_dry.size() < count) {
+		reverb_dry.resize(MaxMixSamples);
+		reverb_wet_l.resize(MaxMixSamples);
+		reverb_wet_r.resize(MaxMixSamples);
+	}
+
+	for (uint32_t channel = 0; channel < 2; ++channel) {
+		float *dry = reverb_dry.data();
+		float *wet = (channel == 0 ? reverb_wet_l.data() : reverb_wet_r.data());
+		if (channel == 0) {
+			for (uint32_t s = 0; s < count; ++s) dry[s] = 0.015f * data[s].l;
+		} else {
+			for (uint32_t s = 0; s < count; ++s) dry[s] = 0.015f * data[s].r;
+		}
+		for (uint32_t s = 0; s < count; ++s) wet[s] = 0.0f;
+
+		//parallel low-passed feedback combs, each run over the whole block:
+		for (uint32_t ci = 0; ci < 4; ++ci) {
+			run_comb(bus.combs[channel * 4 + ci], dry, wet, count, rv.damping, rv.room);
+		}
+
+		//series all-passes:
+		for (uint32_t ai = 0; ai < 2; ++ai) {
+			run_allpass(bus.allpasses[channel * 2 + ai], wet, count);
+		}
+	}
+
+	for (uint32_t s = 0; s < count; ++s) {
+		data[s].l += rv.mix * reverb_wet_l[s];
+		data[s].r += rv.mix * reverb_wet_r[s];
+	}
+}
 
-	//zero the output buffer:
-	for (uint32_t s = 0; s < MixSamples; ++s) {
+//run a bus's effects on its mixed signal and add the result (with bus volume) to 'out':
+void process_bus(Bus &bus, LR *data, LR *out, float ramp_step) {
+	if (bus.lowpass.enabled) run_lowpass(bus, data, mix_samples);
+	if (bus.compressor.enabled) run_compressor(bus, data, mix_samples);
+	if (bus.reverb.enabled) run_reverb(bus, data, mix_samples);
+
+	float start_volume = bus.volume.value;
+	step_value_ramp(bus.volume, ramp_step);
+	float volume_step = (bus.volume.value - start_volume) / mix_samples;
+	for (uint32_t s = 0; s < mix_samples; ++s) {
+		float v = start_volume + volume_step * float(s);
+		out[s].l += v * data[s].l;
+		out[s].r += v * data[s].r;
+	}
+}
+
+//voice counts from the most recent mix_block():
+uint32_t last_active_voices = 0;
+uint32_t last_mixed_voices = 0;
+
+//mix one block of mix_samples stereo samples into buffer:
+void mix_block(LR *buffer) {
+	if (synth_scratch.size() < mix_samples) synth_scratch.resize(mix_samples); //(only allocates if init() wasn't called)
+
+	float ramp_step = float(mix_samples) / float(AudioRate); //ramps advance one block's worth of time per call
+
+	auto block_deadline = std::chrono::steady_clock::now()
+		+ std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< float >(ParallelMixDeadline * ramp_step));
+
+	//zero the output and bus buffers:
+	for (uint32_t s = 0; s < mix_samples; ++s) {
 		buffer[s].l = 0.0f;
 		buffer[s].r = 0.0f;
 	}
+	if (bus_mix.size() < buses.size() * MaxMixSamples) bus_mix.resize(buses.size() * MaxMixSamples); //(only allocates when buses are added)
+	for (uint32_t b = 0; b < buses.size(); ++b) {
+		LR *bus_buffer = bus_mix.data() + size_t(b) * MaxMixSamples;
+		for (uint32_t s = 0; s < mix_samples; ++s) {
+			bus_buffer[s].l = 0.0f;
+			bus_buffer[s].r = 0.0f;
+		}
+	}
 	
 	//Figure out global info (listener position, volume) at start and end of mix period:
 	glm::vec3 start_position = listener.position.value;
 	glm::vec3 start_right = listener.right.value;
 	float start_volume = volume.value;
 
-	step_position_ramp(listener.position);
-	step_direction_ramp(listener.right);
-	step_value_ramp(volume);
+	step_position_ramp(listener.position, ramp_step);
+	step_direction_ramp(listener.right, ramp_step);
+	step_value_ramp(volume, ramp_step);
 
 	glm::vec3 end_position = listener.position.value;
 	glm::vec3 end_right = listener.right.value;
 	float end_volume = volume.value;
 
-	//now add audio for each playing sample:
-	for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
-		PlayingSample &source = **si; //iterator over shared pointers
-
-		//Figure out sample panning/volume at start and end of the mix period:
-		LR start_pan;
-		compute_pan_from_listener_and_position(start_position, start_right, source.position.value, &start_pan.l, &start_pan.r);
-		start_pan.l *= start_volume * source.volume.value;
-		start_pan.r *= start_volume * source.volume.value;
-
-		step_position_ramp(source.position);
-		step_value_ramp(source.volume);
-
-		LR end_pan;
-		compute_pan_from_listener_and_position(end_position, end_right, source.position.value, &end_pan.l, &end_pan.r);
-		end_pan.l *= end_volume * source.volume.value;
-		end_pan.r *= end_volume * source.volume.value;
-
-		LR pan = start_pan;
-		LR pan_step;
-		pan_step.l = (end_pan.l - start_pan.l) / MixSamples;
-		pan_step.r = (end_pan.r - start_pan.r) / MixSamples;
-
-		assert(source.i < source.data.size());
-
-		for (uint32_t i = 0; i < MixSamples; ++i) {
-			//mix one sample based on current pan values:
-			buffer[i].l += pan.l * source.data[source.i];
-			buffer[i].r += pan.r * source.data[source.i];
-
-			//update position in sample:
-			source.i += 1;
-			if (source.i == source.data.size()) {
-				if (source.loop) source.i = 0;
-				else break;
-			}
+	uint64_t block_start = mix_clock.load(std::memory_order_relaxed);
+	uint64_t block_end = block_start + mix_samples;
+
+	//figure out panning/volume for every playing sample at start and end of the mix period,
+	// as a batch: gather spatial state, compute it all in one pass, then scatter results:
+	ListenerFrame start_frame{ start_position, start_right, start_volume };
+	ListenerFrame end_frame{ end_position, end_right, end_volume };
+
+	uint32_t count = uint32_t(playing_samples.size());
+	voice_batch.resize(count);
+	VoiceBatch &vb = voice_batch;
+	{
+		uint32_t v = 0;
+		for (auto const &sp : playing_samples) {
+			PlayingSample const &source = *sp;
+			vb.x[v] = source.position.value.x; vb.y[v] = source.position.value.y; vb.z[v] = source.position.value.z;
+			vb.tx[v] = source.position.target.x; vb.ty[v] = source.position.target.y; vb.tz[v] = source.position.target.z;
+			vb.position_ramp[v] = source.position.ramp;
+			vb.volume[v] = source.volume.value;
+			vb.volume_target[v] = source.volume.target;
+			vb.volume_ramp[v] = source.volume.ramp;
+			++v;
+		}
+	}
 
-			//update pan values:
-			pan.l += pan_step.l;
-			pan.r += pan_step.r;
+	compute_pans(start_frame, vb.x.data(), vb.y.data(), vb.z.data(), vb.volume.data(), vb.start_l.data(), vb.start_r.data(), count);
+
+	//position ramps share one 'remaining' value, so step it once after all three coordinates:
+	{
+		std::vector< float > &remaining = vb.position_ramp;
+		for (uint32_t i = 0; i < count; ++i) {
+			float amt = ramp_step / std::max(remaining[i], ramp_step);
+			vb.x[i] += (vb.tx[i] - vb.x[i]) * amt;
+			vb.y[i] += (vb.ty[i] - vb.y[i]) * amt;
+			vb.z[i] += (vb.tz[i] - vb.z[i]) * amt;
+			remaining[i] = std::max(remaining[i] - ramp_step, 0.0f);
 		}
+	}
+	step_ramps(vb.volume.data(), vb.volume_target.data(), vb.volume_ramp.data(), ramp_step, count);
+
+	compute_pans(end_frame, vb.x.data(), vb.y.data(), vb.z.data(), vb.volume.data(), vb.end_l.data(), vb.end_r.data(), count);
+
+	voice_infos.clear();
+	{
+		uint32_t v = 0;
+		for (auto const &sp : playing_samples) {
+			PlayingSample &source = *sp;
+			source.position.value = glm::vec3(vb.x[v], vb.y[v], vb.z[v]);
+			source.position.ramp = vb.position_ramp[v];
+			source.volume.value = vb.volume[v];
+			source.volume.ramp = vb.volume_ramp[v];
+
+			VoiceInfo info;
+			info.source = &source;
+			info.pending = (source.start >= block_end);
+			info.offset = (source.start > block_start && !info.pending ? uint32_t(source.start - block_start) : 0);
+			info.start_pan.l = vb.start_l[v];
+			info.start_pan.r = vb.start_r[v];
+			info.end_pan.l = vb.end_l[v];
+			info.end_pan.r = vb.end_r[v];
 
-		if (source.i >= source.data.size() //non-looping sample has finished
+			source.level = std::max(
+				std::max(info.start_pan.l, info.start_pan.r),
+				std::max(info.end_pan.l, info.end_pan.r)
+			);
+			info.importance = source.priority * source.level;
+
+			voice_infos.emplace_back(info);
+			++v;
+		}
+	}
+
+	//samples that haven't started yet go to the back and are left alone:
+	auto started_end = std::partition(voice_infos.begin(), voice_infos.end(), [](VoiceInfo const &info){
+		return !info.pending;
+	});
+
+	//partition so the (at most max_voices) most important audible samples come first:
+	auto audible_end = std::partition(voice_infos.begin(), started_end, [](VoiceInfo const &info){
+		return info.source->level > InaudibleLevel;
+	});
+	if (uint32_t(audible_end - voice_infos.begin()) > max_voices) {
+		std::nth_element(voice_infos.begin(), voice_infos.begin() + max_voices, audible_end, [](VoiceInfo const &a, VoiceInfo const &b){
+			return a.importance > b.importance;
+		});
+		audible_end = voice_infos.begin() + max_voices;
+	}
+
+	//now add audio for each mixed sample:
+	for (auto vi = voice_infos.begin(); vi != audible_end; ++vi) {
+		vi->source->virtualized = false;
+	}
+	uint32_t mixed = uint32_t(audible_end - voice_infos.begin());
+	if (mix_pool.workers.empty() || mixed < ParallelMixMinVoices
+	 || !mix_parallel(bus_mix.data(), voice_infos.data(), mixed, block_deadline)) {
+		for (auto vi = voice_infos.begin(); vi != audible_end; ++vi) {
+			mix_voice(*vi, bus_mix.data(), uint32_t(buses.size()), synth_scratch.data());
+		}
+	}
+
+	//run each bus's effects and add it to the output:
+	for (uint32_t b = 0; b < buses.size(); ++b) {
+		process_bus(buses[b], bus_mix.data() + size_t(b) * MaxMixSamples, buffer, ramp_step);
+	}
+
+	last_active_voices = uint32_t(started_end - voice_infos.begin());
+	last_mixed_voices = uint32_t(audible_end - voice_infos.begin());
+
+	//...and just advance the virtual ones:
+	for (auto vi = audible_end; vi != started_end; ++vi) {
+		vi->source->virtualized = true;
+		advance_virtual(*vi->source, vi->offset);
+	}
+
+	mix_clock.store(block_end, std::memory_order_relaxed);
+
+	//remove samples that are done:
+	// (compacting in place keeps the remaining samples in order)
+	auto done = std::remove_if(playing_samples.begin(), playing_samples.end(), [](std::shared_ptr< PlayingSample > const &sp) {
+		PlayingSample &source = *sp;
+		if (source.i >= source.size //non-looping sample has finished
 		 || (source.stopped && source.volume.ramp == 0.0f) //sample has finished stopping
 		 ) {
 		 	source.stopped = true;
-			auto old = si;
-			++si;
-			playing_samples.erase(old);
-		} else {
-			++si;
+			return true;
 		}
-	}
+		return false;
+	});
+	playing_samples.erase(done, playing_samples.end());
 
 	//DEBUG: report output power:
 	float max_power = 0.0f;
-	for (uint32_t s = 0; s < MixSamples; ++s) {
+	for (uint32_t s = 0; s < mix_samples; ++s) {
 		max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
 	}
 	//std::cout << "Max Power: " << std::sqrt(max_power) << std::endl; //DEBUG
+}
 
+//callback instrumentation; written only by the audio thread, read by anyone:
+struct AtomicStats {
+	std::atomic< uint64_t > callbacks{0};
+	std::atomic< uint64_t > underruns{0};
+	std::atomic< uint64_t > late_blocks{0};
+	std::atomic< uint64_t > total_ns{0};
+	std::atomic< uint64_t > max_ns{0};
+	std::atomic< int64_t > min_margin_ns{std::numeric_limits< int64_t >::max()};
+	std::atomic< uint32_t > active_voices{0};
+	std::atomic< uint32_t > mixed_voices{0};
+	std::atomic< uint32_t > max_active_voices{0};
+	std::atomic< uint64_t > histogram[Stats::HistogramBuckets];
+	AtomicStats() {
+		for (auto &h : histogram) h.store(0);
+	}
+} stats;
+
+//(mix_audio's previous start time, for spotting gaps between callbacks)
+std::atomic< int64_t > last_callback_ns{-1};
+
+void mix_audio(void *, Uint8 *stream, int len) {
+	assert(stream); //should always have some audio buffer
+
+	assert(uint32_t(len) == mix_samples * sizeof(LR)); //should always have the expected number of samples
+
+	auto before = std::chrono::steady_clock::now();
+
+	mix_block(reinterpret_cast< LR * >(stream));
+
+	auto after = std::chrono::steady_clock::now();
+
+	//---- record timing ----
+	const int64_t DeadlineNs = int64_t(mix_samples) * 1000000000 / AudioRate;
+	int64_t start_ns = std::chrono::duration_cast< std::chrono::nanoseconds >(before.time_since_epoch()).count();
+	int64_t took_ns = std::chrono::duration_cast< std::chrono::nanoseconds >(after - before).count();
+
+	//a gap of more than ~1.5 blocks since the last callback means the device likely ran dry:
+	int64_t prev_ns = last_callback_ns.exchange(start_ns, std::memory_order_relaxed);
+	if (prev_ns >= 0 && start_ns - prev_ns > DeadlineNs + DeadlineNs / 2) {
+		stats.underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (took_ns > DeadlineNs) {
+		stats.late_blocks.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	stats.callbacks.fetch_add(1, std::memory_order_relaxed);
+	stats.total_ns.fetch_add(uint64_t(took_ns), std::memory_order_relaxed);
+	if (uint64_t(took_ns) > stats.max_ns.load(std::memory_order_relaxed)) {
+		stats.max_ns.store(uint64_t(took_ns), std::memory_order_relaxed); //only the audio thread writes, so no CAS needed
+	}
+	if (DeadlineNs - took_ns < stats.min_margin_ns.load(std::memory_order_relaxed)) {
+		stats.min_margin_ns.store(DeadlineNs - took_ns, std::memory_order_relaxed);
+	}
+
+	uint32_t bucket = uint32_t(took_ns * Stats::BucketsPerDeadline / DeadlineNs);
+	bucket = std::min(bucket, Stats::HistogramBuckets - 1);
+	stats.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	stats.active_voices.store(last_active_voices, std::memory_order_relaxed);
+	stats.mixed_voices.store(last_mixed_voices, std::memory_order_relaxed);
+	if (last_active_voices > stats.max_active_voices.load(std::memory_order_relaxed)) {
+		stats.max_active_voices.store(last_active_voices, std::memory_order_relaxed);
+	}
 };
 
 SDL_AudioDeviceID device = 0;
 
+//add a newly created PlayingSample to playing_samples, stealing a less important one if over budget:
+void start_playing(std::shared_ptr< PlayingSample > const &playing) {
+	lock();
+
+	//a new sample hasn't been mixed yet, so estimate its loudness from where it starts:
+	// (otherwise it would look silent -- and be the first thing stolen -- until its first block)
+	{
+		ListenerFrame frame{ listener.position.value, listener.right.value, volume.value };
+		float l, r;
+		compute_pans(frame, &playing->position.value.x, &playing->position.value.y, &playing->position.value.z, &playing->volume.value, &l, &r, 1);
+		playing->level = std::max(l, r);
+	}
+
+	if (playing_samples.size() >= max_playing_samples) {
+		//samples already fading out after being stolen don't count against the budget:
+		uint32_t live = 0;
+		//steal the least important sample (preferring ones that are already virtual):
+		auto victim = playing_samples.end();
+		for (auto si = playing_samples.begin(); si != playing_samples.end(); ++si) {
+			if ((*si)->stopped) continue;
+			live += 1;
+			if (victim == playing_samples.end()
+			 || (*si)->virtualized > (*victim)->virtualized
+			 || ((*si)->virtualized == (*victim)->virtualized && (*si)->priority * (*si)->level < (*victim)->priority * (*victim)->level)) {
+				victim = si;
+			}
+		}
+		if (live >= max_playing_samples && victim != playing_samples.end() && (*victim)->priority <= playing->priority) {
+			PlayingSample &stolen = **victim;
+			stolen.stopped = true;
+			if (stolen.start >= mix_clock.load(std::memory_order_relaxed)) {
+				//hasn't made any sound yet, so it can just go:
+				playing_samples.erase(victim);
+			} else {
+				//fade out over the next block rather than cutting off (which clicks):
+				stolen.volume.target = 0.0f;
+				stolen.volume.ramp = float(mix_samples) / float(AudioRate);
+			}
+			live -= 1;
+		}
+		if (live >= max_playing_samples) {
+			//everything playing is more important; this sample never starts:
+			playing->stopped = true;
+			unlock();
+			return;
+		}
+	}
+	playing_samples.emplace_back(playing);
+	unlock();
+}
+
+//------------------
+//decoded-audio cache:
+
+//cache files hold a CacheHeader followed immediately by the converted sample data:
+struct CacheHeader {
+	char magic[4] = {'p','c','m','1'};
+	uint32_t storage = 0; //Sample::Storage
+	uint32_t rate = AudioRate;
+	uint32_t count = 0; //number of samples that follow
+	uint64_t source_size = 0;
+	int64_t source_mtime = 0;
+	uint64_t source_hash = 0; //hash of the whole source file
+	float min = 0.0f, max = 0.0f; //sample range (saves re-scanning the data)
+};
+static_assert(sizeof(CacheHeader) == 48, "CacheHeader is packed");
+
+//64-bit FNV-1a, taken a 64-bit word at a time (plenty to notice an edited file, and fast enough to run over whole samples):
+uint64_t hash_bytes(uint64_t hash, char const *bytes, size_t size) {
+	const uint64_t Prime = 0x100000001b3ULL;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * Prime;
+	}
+	for (; i < size; ++i) {
+		hash = (hash ^ uint8_t(bytes[i])) * Prime;
+	}
+	return hash;
+}
+
+//fill in the source_size, source_mtime, and storage fields of 'key' for the file 'filename':
+// (this only stats the file; source_hash is filled in by hash_source() when it is needed)
+bool make_cache_key(std::string const &filename, Sample::Storage storage, CacheHeader *key_) {
+	assert(key_);
+	auto &key = *key_;
+
+	#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(filename.c_str(), &info) != 0) return false;
+	#else
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0) return false;
+	#endif
+	key.storage = uint32_t(storage);
+	key.source_size = uint64_t(info.st_size);
+	key.source_mtime = int64_t(info.st_mtime);
+	return true;
+}
+
+//fill in the source_hash field of 'key' by reading the whole file 'filename':
+bool hash_source(std::string const &filename, CacheHeader *key_) {
+	assert(key_);
+	auto &key = *key_;
+
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) return false;
+	std::vector< char > buffer(65536);
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint64_t total = 0;
+	while (file) {
+		file.read(buffer.data(), buffer.size());
+		size_t got = size_t(file.gcount());
+		hash = hash_bytes(hash, buffer.data(), got);
+		total += got;
+	}
+	if (total != key.source_size) return false; //(changed while reading)
+	key.source_hash = hash;
+	return true;
+}
+
+//cache files live in the user's directory (not next to the shipped data), named for the source file:
+std::string cache_filename_for(std::string const &filename) {
+	size_t slash = filename.find_last_of("/\\");
+	std::string base = (slash == std::string::npos ? filename : filename.substr(slash + 1));
+	//(the full path's hash keeps same-named files in different folders apart)
+	uint64_t hash = hash_bytes(0xcbf29ce484222325ULL, filename.data(), filename.size());
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+	return user_path("sample-cache/" + base + "." + hex + ".pcm");
+}
+
+//map a whole file read-only; returns an empty pointer on failure:
+std::shared_ptr< void const > map_file(std::string const &filename, size_t *size_) {
+	assert(size_);
+	#ifdef _WIN32
+	//no mmap here; just read the file:
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file) return nullptr;
+	*size_ = size_t(file.tellg());
+	std::shared_ptr< char > buffer(new char[*size_], std::default_delete< char[] >());
+	file.seekg(0);
+	if (!file.read(buffer.get(), *size_)) return nullptr;
+	return buffer;
+	#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return nullptr;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return nullptr;
+	}
+	size_t size = size_t(info.st_size);
+	void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //mapping stays valid after close
+	if (addr == MAP_FAILED) return nullptr;
+	*size_ = size;
+	return std::shared_ptr< void const >(addr, [size](void const *a){
+		munmap(const_cast< void * >(a), size);
+	});
+	#endif
+}
+
+//point 'sample' at the data in a cache file, if it exists and matches the source file's 'key':
+// a cache with the source's size and modification time is used as-is, so hits don't read the source at all;
+// if only the time differs (e.g., a checkout touched the file), the source is hashed and, if its contents
+// still match, the cache is used and its header updated to the new time.
+bool load_cache(std::string const &filename, std::string const &cache_filename, CacheHeader const &key, Sample *sample) {
+	size_t size = 0;
+	std::shared_ptr< void const > mapping = map_file(cache_filename, &size);
+	if (!mapping || size < sizeof(CacheHeader)) return false;
+
+	CacheHeader header;
+	memcpy(&header, mapping.get(), sizeof(header));
+	size_t element = (key.storage == Sample::Int16 ? sizeof(int16_t) : sizeof(float));
+	if (memcmp(header.magic, key.magic, 4) != 0
+	 || header.storage != key.storage
+	 || header.rate != key.rate
+	 || header.source_size != key.source_size
+	 || header.count == 0
+	 || size != sizeof(CacheHeader) + header.count * element) {
+		return false;
+	}
+	if (header.source_mtime != key.source_mtime) {
+		CacheHeader hashed = key;
+		if (!hash_source(filename, &hashed) || hashed.source_hash != header.source_hash) return false;
+		//same contents, so just note the new time (if this fails, the next load hashes again):
+		header.source_mtime = key.source_mtime;
+		std::fstream file(cache_filename, std::ios::binary | std::ios::in | std::ios::out);
+		file.write(reinterpret_cast< char const * >(&header), sizeof(header));
+	}
+
+	sample->mapping = mapping;
+	sample->pcm = reinterpret_cast< char const * >(mapping.get()) + sizeof(CacheHeader);
+	sample->count = header.count;
+	std::cout << "Range: " << header.min << ", " << header.max << " (cached)" << std::endl;
+	return true;
+}
+
+//write 'sample' (plus the key) to a cache file; failure is only a warning:
+void save_cache(std::string const &cache_filename, CacheHeader key, Sample const &sample) {
+	key.count = sample.count;
+	size_t element = (sample.storage == Sample::Int16 ? sizeof(int16_t) : sizeof(float));
+	//write to a temporary file and rename it into place, so a reader never maps a half-written cache:
+	// (the name is unique per sample, since several may be decoding on different threads)
+	std::string temp_filename = cache_filename + "." + std::to_string(reinterpret_cast< uintptr_t >(&sample)) + ".tmp";
+	{
+		std::ofstream file(temp_filename, std::ios::binary);
+		file.write(reinterpret_cast< char const * >(&key), sizeof(key));
+		file.write(reinterpret_cast< char const * >(sample.pcm), sample.count * element);
+		if (!file) {
+			std::cerr << "WARNING: couldn't write decoded-audio cache '" << cache_filename << "'." << std::endl;
+			file.close();
+			std::remove(temp_filename.c_str());
+			return;
+		}
+	}
+	#ifdef _WIN32
+	std::remove(cache_filename.c_str()); //(rename won't replace an existing file on windows)
+	#endif
+	if (std::rename(temp_filename.c_str(), cache_filename.c_str()) != 0) {
+		std::cerr << "WARNING: couldn't write decoded-audio cache '" << cache_filename << "'." << std::endl;
+		std::remove(temp_filename.c_str());
+	}
+}
+
 } //end anon namespace
 
 //------------------
 
-Sample::Sample(std::string const &filename) {
+Sample::Sample(std::string const &filename, Storage storage_) : storage(storage_) {
+	CacheHeader key;
+	bool cacheable = use_sample_cache && make_cache_key(filename, storage, &key);
+	std::string cache_filename;
+	if (cacheable) {
+		try {
+			cache_filename = cache_filename_for(filename);
+		} catch (std::exception &e) {
+			std::cerr << "WARNING: not caching decoded audio (" << e.what() << ")." << std::endl;
+			cacheable = false;
+		}
+	}
+	if (cacheable && load_cache(filename, cache_filename, key, this)) {
+		return;
+	}
+
 	SDL_AudioSpec audio_spec;
 	Uint8 *audio_buf = nullptr;
 	Uint32 audio_len = 0;
@@ -211,19 +1194,32 @@ Sample::Sample(std::string const &filename) {
 		throw std::runtime_error("Failed to load WAV file '" + filename + "'; SDL says \"" + std::string(SDL_GetError()) + "\"");
 	}
 
+	//copy converted data into whichever vector matches the storage format:
+	auto assign = [this](Uint8 const *begin, Uint8 const *end) {
+		if (storage == Int16) {
+			data16.assign(reinterpret_cast< int16_t const * >(begin), reinterpret_cast< int16_t const * >(end));
+			pcm = data16.data();
+			count = uint32_t(data16.size());
+		} else {
+			data.assign(reinterpret_cast< float const * >(begin), reinterpret_cast< float const * >(end));
+			pcm = data.data();
+			count = uint32_t(data.size());
+		}
+	};
+
 	//based on the SDL_AudioCVT example in the docs: https://wiki.libsdl.org/SDL_AudioCVT
 	SDL_AudioCVT cvt;
-	SDL_BuildAudioCVT(&cvt, have->format, have->channels, have->freq, AUDIO_F32SYS, 1, AudioRate);
+	SDL_BuildAudioCVT(&cvt, have->format, have->channels, have->freq, (storage == Int16 ? AUDIO_S16SYS : AUDIO_F32SYS), 1, AudioRate);
 	if (cvt.needed) {
-		std::cout << "WAV file '" + filename + "' didn't load as " + std::to_string(AudioRate) + " Hz, float32, mono; converting." << std::endl;
+		std::cout << "WAV file '" + filename + "' didn't load as " + std::to_string(AudioRate) + " Hz, " + (storage == Int16 ? "int16" : "float32") + ", mono; converting." << std::endl;
 		cvt.len = audio_len;
 		cvt.buf = (Uint8 *)SDL_malloc(cvt.len * cvt.len_mult);
 		SDL_memcpy(cvt.buf, audio_buf, audio_len);
 		SDL_ConvertAudio(&cvt);
-		data.assign(reinterpret_cast< float * >(cvt.buf), reinterpret_cast< float * >(cvt.buf + cvt.len_cvt));
+		assign(cvt.buf, cvt.buf + cvt.len_cvt);
 		SDL_free(cvt.buf);
 	} else {
-		data.assign(reinterpret_cast< float * >(audio_buf), reinterpret_cast< float * >(audio_buf + audio_len));
+		assign(audio_buf, audio_buf + audio_len);
 	}
 	SDL_FreeWAV(audio_buf);
 
@@ -233,16 +1229,62 @@ Sample::Sample(std::string const &filename) {
 		min = std::min(min, d);
 		max = std::max(max, d);
 	}
+	for (auto d : data16) {
+		min = std::min(min, d / 32768.0f);
+		max = std::max(max, d / 32768.0f);
+	}
 	std::cout << "Range: " << min << ", " << max << std::endl;
+
+	if (cacheable && hash_source(filename, &key)) {
+		key.min = min;
+		key.max = max;
+		save_cache(cache_filename, key, *this);
+	}
 }
 
-std::shared_ptr< PlayingSample > Sample::play(glm::vec3 const &position, float volume, LoopOrOnce loop_or_once) const {
-	lock();
-	playing_samples.emplace_back(std::make_shared< PlayingSample >(this, position, volume, loop_or_once == Loop));
-	unlock();
-	return playing_samples.back();
+std::shared_future< Sample const * > Sample::load_async(std::string const &filename, Storage storage) {
+	auto task = std::make_shared< std::packaged_task< Sample const *() > >([filename, storage]() -> Sample const * {
+		return new Sample(filename, storage);
+	});
+	std::shared_future< Sample const * > result = task->get_future().share();
+	WorkerPool::shared().run([task](){ (*task)(); });
+	return result;
 }
 
+std::shared_ptr< PlayingSample > Sample::play(glm::vec3 const &position, float volume, LoopOrOnce loop_or_once, float priority) const {
+	return play_at(0, position, volume, loop_or_once, priority);
+}
+
+std::shared_ptr< PlayingSample > Sample::play_at(uint64_t start, glm::vec3 const &position, float volume, LoopOrOnce loop_or_once, float priority) const {
+	std::shared_ptr< PlayingSample > playing = std::make_shared< PlayingSample >(this, position, volume, loop_or_once == Loop, priority);
+	playing->start = start;
+	start_playing(playing);
+	return playing;
+}
+
+//------------------
+
+std::shared_ptr< PlayingSample > Synth::play(float frequency, glm::vec3 const &position, float volume, float length, LoopOrOnce loop_or_once, float priority) const {
+	return play_at(0, frequency, position, volume, length, loop_or_once, priority);
+}
+
+std::shared_ptr< PlayingSample > Synth::play_at(uint64_t start, float frequency, glm::vec3 const &position, float volume, float length, LoopOrOnce loop_or_once, float priority) const {
+	std::shared_ptr< PlayingSample > playing = std::make_shared< PlayingSample >(this, frequency, length, position, volume, loop_or_once == Loop, priority);
+	playing->start = start;
+	start_playing(playing);
+	return playing;
+}
+
+PlayingSample::PlayingSample(Synth const *synth_, float frequency_, float length_, glm::vec3 const &position_, float volume_, bool hold_, float priority_)
+	: bus(synth_->bus), synth(*synth_), priority(priority_), position(position_), volume(volume_), frequency(frequency_) {
+	if (hold_) {
+		//held notes never release on their own; they end when stop() fades them out:
+		release_at = size = std::numeric_limits< uint32_t >::max();
+	} else {
+		release_at = uint32_t(std::max(0.0f, length_) * AudioRate);
+		size = release_at + uint32_t(synth.release * AudioRate) + 1;
+	}
+}
 
 //------------------
 
@@ -252,6 +1294,13 @@ void PlayingSample::set_position(glm::vec3 const &new_position, float ramp) {
 	unlock();
 }
 
+void PlayingSample::set_bus(uint32_t new_bus) {
+	assert(new_bus < buses.size());
+	lock();
+	bus = new_bus;
+	unlock();
+}
+
 void PlayingSample::set_volume(float new_volume, float ramp) {
 	lock();
 	volume.set(new_volume, ramp);
@@ -291,7 +1340,9 @@ void Listener::set_right(glm::vec3 const &new_right, float ramp) {
 
 //------------------
 
-void init() {
+void init(uint32_t mix_samples_) {
+	set_mix_samples(mix_samples_);
+
 	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
 		std::cerr << "Failed to initialize SDL audio subsytem:\n" << SDL_GetError() << std::endl;
 		return;
@@ -303,17 +1354,45 @@ void init() {
 	want.freq = AudioRate;
 	want.format = AUDIO_F32SYS;
 	want.channels = 2;
-	want.samples = MixSamples;
+	want.samples = mix_samples;
 	want.callback = mix_audio;
 
+	playing_samples.reserve(max_playing_samples);
+	voice_infos.reserve(max_playing_samples);
+	voice_batch.reserve(max_playing_samples);
+	synth_scratch.resize(mix_samples);
+	bus_mix.resize(buses.size() * MaxMixSamples);
+	reverb_dry.resize(MaxMixSamples);
+	reverb_wet_l.resize(MaxMixSamples);
+	reverb_wet_r.resize(MaxMixSamples);
+
 	device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
 	if (device == 0) {
 		std::cerr << "Failed to open audio device:\n" << SDL_GetError() << std::endl;
 	} else {
 		//start audio playback:
 		SDL_PauseAudioDevice(device, 0);
-		std::cout << "Audio output initialized." << std::endl;
+		std::cout << "Audio output initialized (" << mix_samples << " samples per block, ~" << output_latency() * 1000.0f << " ms output latency)." << std::endl;
+	}
+}
+
+uint32_t get_mix_samples() {
+	return mix_samples;
+}
+
+void set_mix_samples(uint32_t count) {
+	if (count < MinMixSamples || count > MaxMixSamples || (count & (count - 1)) != 0) {
+		throw std::runtime_error("Mix block size " + std::to_string(count) + " isn't a power of two between " + std::to_string(MinMixSamples) + " and " + std::to_string(MaxMixSamples) + ".");
+	}
+	if (device) {
+		throw std::runtime_error("Can't change the mix block size while the audio device is open.");
 	}
+	{ //mixing threads read the block size:
+		std::unique_lock< std::mutex > guard(mix_pool.mutex);
+		mix_pool.done_cv.wait(guard, [](){ return mix_pool.idle(); });
+	}
+	mix_samples = count;
+	if (synth_scratch.size() < mix_samples) synth_scratch.resize(mix_samples);
 }
 
 void lock() {
@@ -332,6 +1411,149 @@ void stop_all_samples() {
 	unlock();
 }
 
+uint32_t add_bus() {
+	lock();
+	buses.emplace_back();
+	uint32_t index = uint32_t(buses.size()) - 1;
+	unlock();
+	return index;
+}
+
+void set_mix_threads(uint32_t count) {
+	lock();
+	mix_pool.start(count);
+	unlock();
+}
+
+void set_voice_limits(uint32_t max_voices_, uint32_t max_playing_samples_) {
+	assert(max_voices_ >= 1 && max_voices_ <= max_playing_samples_);
+	lock();
+	max_voices = max_voices_;
+	max_playing_samples = max_playing_samples_;
+	//if the limit shrank, drop the least important extra samples:
+	while (playing_samples.size() > max_playing_samples) {
+		auto victim = std::min_element(playing_samples.begin(), playing_samples.end(), [](std::shared_ptr< PlayingSample > const &a, std::shared_ptr< PlayingSample > const &b){
+			return a->priority * a->level < b->priority * b->level;
+		});
+		(*victim)->stopped = true;
+		playing_samples.erase(victim);
+	}
+	playing_samples.reserve(max_playing_samples);
+	voice_infos.reserve(max_playing_samples);
+	voice_batch.reserve(max_playing_samples);
+	unlock();
+}
+
+void render(uint32_t blocks, std::vector< float > *out_, std::vector< double > *block_seconds) {
+	assert(out_);
+	auto &out = *out_;
+	out.assign(size_t(blocks) * mix_samples * 2, 0.0f);
+	if (block_seconds) block_seconds->assign(blocks, 0.0);
+
+	lock();
+	for (uint32_t b = 0; b < blocks; ++b) {
+		auto before = std::chrono::steady_clock::now();
+		mix_block(reinterpret_cast< LR * >(out.data() + size_t(b) * mix_samples * 2));
+		auto after = std::chrono::steady_clock::now();
+		if (block_seconds) (*block_seconds)[b] = std::chrono::duration< double >(after - before).count();
+	}
+	unlock();
+}
+
+void save_wav(std::string const &filename, std::vector< float > const &data) {
+	std::ofstream file(filename, std::ios::binary);
+
+	//canonical 44-byte RIFF header for IEEE float (format 3) stereo data:
+	struct WavHeader {
+		char riff[4] = {'R','I','F','F'};
+		uint32_t riff_size = 0;
+		char wave[4] = {'W','A','V','E'};
+		char fmt[4] = {'f','m','t',' '};
+		uint32_t fmt_size = 16;
+		uint16_t format = 3; //WAVE_FORMAT_IEEE_FLOAT
+		uint16_t channels = 2;
+		uint32_t rate = AudioRate;
+		uint32_t byte_rate = AudioRate * 2 * sizeof(float);
+		uint16_t block_align = 2 * sizeof(float);
+		uint16_t bits = 8 * sizeof(float);
+		char data[4] = {'d','a','t','a'};
+		uint32_t data_size = 0;
+	};
+	static_assert(sizeof(WavHeader) == 44, "WavHeader is packed");
+
+	WavHeader header;
+	header.data_size = uint32_t(data.size() * sizeof(float));
+	header.riff_size = 36 + header.data_size;
+
+	file.write(reinterpret_cast< char const * >(&header), sizeof(header));
+	file.write(reinterpret_cast< char const * >(data.data()), header.data_size);
+	if (!file) {
+		throw std::runtime_error("Failed to write WAV file '" + filename + "'");
+	}
+}
+
+float output_latency() {
+	//SDL plays one block while the next is being mixed:
+	return 2.0f * float(mix_samples) / float(AudioRate);
+}
+
+uint64_t audio_clock() {
+	return mix_clock.load(std::memory_order_relaxed);
+}
+
+Stats get_stats() {
+	Stats ret;
+	ret.callbacks = stats.callbacks.load(std::memory_order_relaxed);
+	ret.underruns = stats.underruns.load(std::memory_order_relaxed);
+	ret.late_blocks = stats.late_blocks.load(std::memory_order_relaxed);
+	ret.late_partials = late_partials.load(std::memory_order_relaxed);
+	ret.deadline = float(mix_samples) / float(AudioRate);
+	if (ret.callbacks) {
+		ret.mean_mix_time = float(double(stats.total_ns.load(std::memory_order_relaxed)) * 1e-9 / double(ret.callbacks));
+		ret.max_mix_time = float(double(stats.max_ns.load(std::memory_order_relaxed)) * 1e-9);
+		ret.min_margin = float(double(stats.min_margin_ns.load(std::memory_order_relaxed)) * 1e-9);
+	}
+	ret.active_voices = stats.active_voices.load(std::memory_order_relaxed);
+	ret.mixed_voices = stats.mixed_voices.load(std::memory_order_relaxed);
+	ret.max_active_voices = stats.max_active_voices.load(std::memory_order_relaxed);
+	for (uint32_t b = 0; b < Stats::HistogramBuckets; ++b) {
+		ret.histogram[b] = stats.histogram[b].load(std::memory_order_relaxed);
+	}
+	return ret;
+}
+
+void reset_stats() {
+	lock(); //so the audio thread isn't halfway through an update
+	stats.callbacks = 0;
+	stats.underruns = 0;
+	stats.late_blocks = 0;
+	late_partials = 0;
+	stats.total_ns = 0;
+	stats.max_ns = 0;
+	stats.min_margin_ns = std::numeric_limits< int64_t >::max();
+	stats.max_active_voices = 0;
+	for (auto &h : stats.histogram) h = 0;
+	last_callback_ns = -1;
+	unlock();
+}
+
+void dump_stats(std::ostream &out) {
+	Stats s = get_stats();
+	out << "Sound: " << s.callbacks << " callbacks, " << s.underruns << " underruns, " << s.late_blocks << " late blocks, " << s.late_partials << " dropped partial blocks.\n";
+	out << "  mix time mean " << s.mean_mix_time * 1000.0f << " ms, max " << s.max_mix_time * 1000.0f << " ms"
+	    << " (deadline " << s.deadline * 1000.0f << " ms, min margin " << s.min_margin * 1000.0f << " ms)\n";
+	out << "  voices: " << s.active_voices << " active, " << s.mixed_voices << " mixed, " << s.max_active_voices << " max active\n";
+	out << "  mix time / deadline histogram:\n";
+	for (uint32_t b = 0; b < Stats::HistogramBuckets; ++b) {
+		if (s.histogram[b] == 0) continue;
+		out << "    [" << float(b) / Stats::BucketsPerDeadline << ", ";
+		if (b + 1 == Stats::HistogramBuckets) out << "inf";
+		else out << float(b + 1) / Stats::BucketsPerDeadline;
+		out << "): " << s.histogram[b] << "\n";
+	}
+	out.flush();
+}
+
 void set_volume(float new_volume, float ramp) {
 	lock();
 	volume.set(new_volume, ramp);
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <iosfwd>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -18,22 +24,107 @@ enum LoopOrOnce {
 
 // 'Sample' objects are mono (one-channel) audio 
 struct Sample {
+	//how sample data is kept in memory:
+	enum Storage {
+		Float32, //32-bit float (data)
+		Int16 //16-bit signed integer (data16); half the memory, converted to float while mixing
+	};
+
 	//load from a ".wav" file:
 	// will warn and downmix to mono if file is stereo
 	// will warn and perform not-very-good interpolation if file is not Sound::AudioRate
-	Sample(std::string const &filename);
+	// converted data is cached under user_path("sample-cache/") and memory-mapped on later loads (see use_sample_cache)
+	Sample(std::string const &filename, Storage storage = Float32);
+
+	//load a sample on a background decoding thread; get() on the result waits for it (and rethrows any load error):
+	static std::shared_future< Sample const * > load_async(std::string const &filename, Storage storage = Float32);
 
 	//start playing an instance of this sample at a given initial position and volume:
 	// the returned 'PlayingSample' handle can be used to change position, fade volume, or cancel playback.
+	// 'priority' scales how important the sample is when the voice budget (see set_voice_limits) is exceeded.
 	std::shared_ptr< PlayingSample > play(
 		glm::vec3 const &position,
 		float volume = 1.0f,
-		LoopOrOnce loop_or_once = Once
+		LoopOrOnce loop_or_once = Once,
+		float priority = 1.0f
+	) const;
+
+	//as above, but the first sample of playback lands exactly at audio clock time 'start' (see audio_clock()):
+	// (if 'start' has already been mixed, playback begins with the next mixed block)
+	std::shared_ptr< PlayingSample > play_at(
+		uint64_t start,
+		glm::vec3 const &position,
+		float volume = 1.0f,
+		LoopOrOnce loop_or_once = Once,
+		float priority = 1.0f
+	) const;
+
+	Sample(Sample const &) = delete; //pcm may point into this object's own vectors
+
+	//number of (mono) samples:
+	uint32_t size() const { return count; }
+
+	uint32_t bus = 0; //bus that playing instances of this sample mix into (see Bus)
+
+	Storage storage = Float32;
+	void const *pcm = nullptr; //sample data, in 'storage' format; points into data, data16, or a memory-mapped cache file
+	uint32_t count = 0;
+
+	//internals:
+	std::vector< float > data; //owned Float32 data (empty if memory-mapped)
+	std::vector< int16_t > data16; //owned Int16 data (empty if memory-mapped)
+	std::shared_ptr< void const > mapping; //keeps a memory-mapped cache file alive
+};
+
+// 'Synth' objects describe a procedural mallet-like instrument (two-operator FM with an ADSR envelope);
+// they can play any pitch without any sample data.
+// Each note copies its instrument, so a Synth may be changed or destroyed while its notes are still playing:
+struct Synth {
+	//start playing a note at 'frequency' (Hz); the note is held for 'length' seconds, then released:
+	// (with LoopOrOnce == Loop the note is held until stop() is called)
+	std::shared_ptr< PlayingSample > play(
+		float frequency,
+		glm::vec3 const &position,
+		float volume = 1.0f,
+		float length = 0.5f,
+		LoopOrOnce loop_or_once = Once,
+		float priority = 1.0f
+	) const;
+
+	//as above, but starting at audio clock time 'start' (see audio_clock()):
+	std::shared_ptr< PlayingSample > play_at(
+		uint64_t start,
+		float frequency,
+		glm::vec3 const &position,
+		float volume = 1.0f,
+		float length = 0.5f,
+		LoopOrOnce loop_or_once = Once,
+		float priority = 1.0f
 	) const;
 
-	std::vector< float > data;
+	//envelope (times in seconds):
+	float attack = 0.002f;
+	float decay = 1.2f;
+	float sustain = 0.0f; //level held after decay (0 gives a struck, mallet-like note)
+	float release = 0.15f;
+
+	//FM timbre:
+	float ratio = 3.5f; //modulator frequency / carrier frequency
+	float index = 0.6f; //modulation depth at note start (in cycles of carrier phase)
+	float brightness = 0.08f; //time constant (seconds) over which modulation depth decays
+
+	float gain = 0.5f;
+
+	uint32_t bus = 0; //bus that notes mix into (see Bus)
+
+	//frequency of a note given in semitones from A4 (440 Hz):
+	static float note_frequency(float semitones_from_a4) { return 440.0f * std::pow(2.0f, semitones_from_a4 / 12.0f); }
 };
 
+//should Sample() read and write decoded-audio cache files?
+// (cache files are keyed by the source's size and modification time; if only the time changed, a hash of its contents decides)
+extern bool use_sample_cache;
+
 //Ramp<> is a template to help with managing values that should be smoothly
 // interpolated to a target over a certain amount of time:
 template< typename T >
@@ -60,20 +151,80 @@ struct PlayingSample {
 	void set_position(glm::vec3 const &new_position, float ramp = 1.0f / 60.0f);
 	void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 	void stop(float ramp = 1.0f / 60.0f);
+	//move to a different bus:
+	void set_bus(uint32_t new_bus);
 
 	//internals:
-	std::vector< float > const &data; //reference to sample data being played
+	uint32_t bus = 0; //bus this mixes into
+	Sample const *sample = nullptr; //sample being played (or nullptr for a synthesized note)
+	Synth synth; //copy of the instrument playing a synthesized note (unused for a sample)
+	uint32_t size = 0; //total number of samples this will produce (per loop)
 	uint32_t i = 0; //next data value to read
 	bool loop = false; //should playback loop after data runs out?
 	bool stopped = false; //was playback stopped (either by running out of sample, or by stop())?
+	float priority = 1.0f; //multiplies loudness when deciding which samples to mix or steal
+	float level = 0.0f; //loudness (max pan * volume) during the last mixed block (estimated from the start position until then)
+	bool virtualized = false; //was this sample skipped (but still advanced) in the last mixed block?
+	uint64_t start = 0; //audio clock time at which playback begins
 
 	Ramp< glm::vec3 > position = Ramp< glm::vec3 >(0.0f);
 	Ramp< float > volume = Ramp< float >(1.0f);
 
-	PlayingSample(Sample const *sample_, glm::vec3 const &position_, float volume_, bool loop_)
-		: data(sample_->data), loop(loop_), position(position_), volume(volume_) { }
+	//synthesized note state:
+	float frequency = 0.0f; //Hz
+	uint32_t release_at = 0; //value of 'i' at which the note is released
+	float phase = 0.0f; //carrier phase (cycles)
+	float mod_phase = 0.0f; //modulator phase (cycles)
+
+	PlayingSample(Sample const *sample_, glm::vec3 const &position_, float volume_, bool loop_, float priority_ = 1.0f)
+		: bus(sample_->bus), sample(sample_), size(sample_->size()), loop(loop_), priority(priority_), position(position_), volume(volume_) { }
+	PlayingSample(Synth const *synth_, float frequency_, float length_, glm::vec3 const &position_, float volume_, bool hold_, float priority_ = 1.0f);
 };
 
+//Buses: every playing sample mixes into a bus (by default bus 0, the master bus);
+// each bus runs its effects once per block on its summed signal and adds the result to the output,
+// so shared effects cost the same no matter how many samples feed them.
+struct Bus {
+	Ramp< float > volume = Ramp< float >(1.0f);
+
+	//one-pole low-pass filter:
+	struct LowPass {
+		bool enabled = false;
+		float cutoff = 2000.0f; //Hz
+	} lowpass;
+
+	//peak compressor:
+	struct Compressor {
+		bool enabled = false;
+		float threshold = 0.5f; //level above which gain is reduced
+		float ratio = 4.0f; //input:output ratio above threshold
+		float attack = 0.005f; //seconds
+		float release = 0.1f; //seconds
+	} compressor;
+
+	//Schroeder-style reverb (parallel combs into series all-passes):
+	struct Reverb {
+		bool enabled = false;
+		float mix = 0.25f; //wet amount
+		float room = 0.8f; //comb feedback; larger is a longer tail
+		float damping = 0.3f; //high-frequency loss in the tail
+	} reverb;
+
+	//internals (filter state):
+	float lowpass_l = 0.0f, lowpass_r = 0.0f;
+	float envelope = 0.0f;
+	struct Delay {
+		std::vector< float > data;
+		uint32_t at = 0;
+		float store = 0.0f; //comb low-pass state
+	};
+	std::vector< Delay > combs; //left combs, then right combs
+	std::vector< Delay > allpasses; //left all-passes, then right all-passes
+};
+//buses[0] is the master bus; change bus settings between lock() and unlock():
+extern std::vector< Bus > buses;
+uint32_t add_bus(); //returns the index of a new (effect-less) bus
+
 struct Listener {
 	void set_position(glm::vec3 const &new_position, float ramp = 1.0f / 60.0f);
 	void set_right(glm::vec3 const &new_right, float ramp = 1.0f / 60.0f);
@@ -87,9 +238,25 @@ extern struct Listener listener;
 
 
 constexpr const uint32_t AudioRate = 48000; //sample rate, in Hz, for audio output
-constexpr const uint32_t MixSamples = 1024; //samples to mix at once; SDL requires a power of two; smaller values mean more reactive sound, but require more frequent audio callback invocation
+//samples to mix at once (chosen by init()); SDL requires a power of two; smaller values mean more reactive sound, but require more frequent audio callback invocation
+constexpr const uint32_t DefaultMixSamples = 1024; //~21ms at AudioRate
+constexpr const uint32_t MinMixSamples = 64;
+constexpr const uint32_t MaxMixSamples = 4096;
+uint32_t get_mix_samples();
+//render() also uses the block size, so set it here when rendering offline without init():
+// (throws if 'count' isn't a power of two in [MinMixSamples, MaxMixSamples] or the audio device is already open)
+void set_mix_samples(uint32_t count);
+
+//The audio clock counts mixed samples; audio_clock() is the time of the first sample of the next block to be mixed.
+// Schedule sounds with play_at(audio_clock() + delay) to get sample-accurate timing regardless of frame rate.
+uint64_t audio_clock();
+inline uint64_t seconds_to_samples(float seconds) { return uint64_t(std::max(0.0f, seconds) * AudioRate + 0.5f); }
+
+void init(uint32_t mix_samples = DefaultMixSamples); //should call Sound::init() from main.cpp before using any member functions (throws if mix_samples is invalid; see set_mix_samples)
 
-void init(); //should call Sound::init() from main.cpp before using any member functions
+//estimated delay (in seconds) between a play() call and the sound reaching the output device:
+// (input-to-audio latency is this plus up to a frame for the event to be handled)
+float output_latency();
 
 //the audio callback doesn't run between Sound::lock() and Sound::unlock()
 // the set_*/stop/play/... functions already use these helpers, so you shouldn't need
@@ -99,7 +266,56 @@ void unlock();
 
 void stop_all_samples(); //sort of a 'panic button' to stop all playing samples
 
+//Voice budget:
+// at most 'max_voices' samples are actually mixed each block -- the most important (priority * loudness) ones;
+// the rest are 'virtual': they keep advancing through their data but cost nothing to mix.
+// Samples quieter than InaudibleLevel are always virtual.
+// At most 'max_playing_samples' samples are tracked at all; beyond that, play() steals the least important one.
+constexpr const float InaudibleLevel = 1.0e-4f;
+void set_voice_limits(uint32_t max_voices, uint32_t max_playing_samples);
+extern uint32_t max_voices;
+extern uint32_t max_playing_samples;
+
 void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 extern Ramp< float > volume;
 
+//Multi-threaded mixing:
+// with 'count' > 0, blocks with many mixed samples are shared between the audio callback and 'count' worker threads,
+// which each mix a partial block for the callback to sum; a worker that isn't done by the deadline has its partial dropped.
+// Workers mix copies of the samples' playback state, so PlayingSample setters (and add_bus, set_voice_limits) never wait for them.
+// Can be called again to change the number of threads.
+// (0, the default, mixes everything in the audio callback; render() output is only bit-exact with 0 threads.)
+void set_mix_threads(uint32_t count);
+
+//Audio callback instrumentation:
+// counters are updated lock-free by the audio thread; get_stats() takes a snapshot from any thread.
+struct Stats {
+	uint64_t callbacks = 0; //number of audio callbacks so far
+	uint64_t underruns = 0; //callbacks that started more than 1.5 blocks after the previous one (device probably ran dry)
+	uint64_t late_blocks = 0; //callbacks that took longer than a block's duration to mix
+	uint64_t late_partials = 0; //partial blocks dropped because a mixing thread missed its deadline (see set_mix_threads)
+	float deadline = 0.0f; //duration of one block, in seconds
+	float mean_mix_time = 0.0f; //seconds
+	float max_mix_time = 0.0f; //seconds
+	float min_margin = 0.0f; //smallest (deadline - mix time), in seconds
+	uint32_t active_voices = 0; //playing samples during the last callback
+	uint32_t mixed_voices = 0; //...of which this many were actually mixed
+	uint32_t max_active_voices = 0;
+	//histogram of mix time as a fraction of the deadline; bucket b counts times in [b, b+1) / BucketsPerDeadline (last bucket is open-ended):
+	static constexpr const uint32_t BucketsPerDeadline = 8;
+	static constexpr const uint32_t HistogramBuckets = 2 * BucketsPerDeadline + 1;
+	uint64_t histogram[HistogramBuckets] = { 0 };
+};
+Stats get_stats();
+void reset_stats();
+void dump_stats(std::ostream &out);
+
+//Offline rendering, for benchmarks and tests on machines without audio output:
+// (doesn't need init(); the mixer is deterministic, so the same play() calls give the same output)
+//render() advances the mixer by 'blocks' blocks of get_mix_samples() samples, storing interleaved L,R samples in 'out'
+// and, if 'block_seconds' is given, the time spent mixing each block:
+void render(uint32_t blocks, std::vector< float > *out, std::vector< double > *block_seconds = nullptr);
+//save_wav() writes interleaved stereo samples (as from render()) to a 32-bit float ".wav" file:
+void save_wav(std::string const &filename, std::vector< float > const &data);
+
 }; //namespace Sound
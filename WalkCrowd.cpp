@@ -0,0 +1,227 @@
+#include "WalkCrowd.hpp"
+
+#include "WorkerPool.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+WalkCrowd::WalkCrowd(WalkMesh const &mesh_) : mesh(mesh_) {
+}
+
+uint32_t WalkCrowd::add_agent(WalkMesh::WalkPoint const &at, float radius, float max_speed) {
+	assert(at.index < mesh.triangles.size());
+	walk_points.emplace_back(at);
+	preferred_velocities.emplace_back(0.0f);
+	velocities.emplace_back(0.0f);
+	radii.emplace_back(radius);
+	max_speeds.emplace_back(max_speed);
+	return uint32_t(walk_points.size() - 1);
+}
+
+template< typename T >
+static void swap_remove(std::vector< T > &vec, uint32_t index) {
+	vec[index] = vec.back();
+	vec.pop_back();
+}
+
+void WalkCrowd::remove_agent(uint32_t agent) {
+	assert(agent < walk_points.size());
+	swap_remove(walk_points, agent);
+	swap_remove(preferred_velocities, agent);
+	swap_remove(velocities, agent);
+	swap_remove(radii, agent);
+	swap_remove(max_speeds, agent);
+}
+
+void WalkCrowd::update(float elapsed) {
+	uint32_t count = uint32_t(walk_points.size());
+
+	positions.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		positions[i] = mesh.world_point(walk_points[i]);
+	}
+	rebuild_hash();
+
+	//pick velocities (reads last tick's velocities, so every agent can be handled independently):
+	new_velocities.resize(count);
+	split_across_threads(count, MinAgentsPerThread, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			new_velocities[i] = choose_velocity(uint32_t(i));
+		}
+	});
+	velocities.swap(new_velocities);
+
+	//move:
+	steps.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		steps[i] = velocities[i] * elapsed;
+	}
+	mesh.walk(walk_points.data(), steps.data(), count);
+}
+
+uint32_t WalkCrowd::bucket(glm::ivec3 const &cell) const {
+	uint32_t h = uint32_t(cell.x) * 73856093U ^ uint32_t(cell.y) * 19349663U ^ uint32_t(cell.z) * 83492791U;
+	return h & uint32_t(cell_first.size() - 2); //(bucket count is a power of two)
+}
+
+void WalkCrowd::rebuild_hash() {
+	//about two buckets per agent:
+	uint32_t buckets = 1;
+	while (buckets < 2 * positions.size()) buckets *= 2;
+
+	auto cell_of = [this](glm::vec3 const &p) {
+		return glm::ivec3(
+			int32_t(std::floor(p.x / neighbor_distance)),
+			int32_t(std::floor(p.y / neighbor_distance)),
+			int32_t(std::floor(p.z / neighbor_distance))
+		);
+	};
+
+	//counting sort of agents by bucket:
+	cell_first.assign(buckets + 1, 0);
+	std::vector< uint32_t > &agent_bucket = cell_agents; //(borrowed as scratch until the fill pass)
+	agent_bucket.resize(positions.size());
+	for (uint32_t i = 0; i < positions.size(); ++i) {
+		agent_bucket[i] = bucket(cell_of(positions[i]));
+		cell_first[agent_bucket[i] + 1] += 1;
+	}
+	for (uint32_t b = 1; b < cell_first.size(); ++b) {
+		cell_first[b] += cell_first[b-1];
+	}
+	std::vector< uint32_t > next(cell_first.begin(), cell_first.end() - 1);
+	std::vector< uint32_t > sorted(positions.size());
+	for (uint32_t i = 0; i < positions.size(); ++i) {
+		sorted[next[agent_bucket[i]]++] = i;
+	}
+	cell_agents.swap(sorted);
+}
+
+glm::vec3 WalkCrowd::choose_velocity(uint32_t agent) const {
+	glm::vec3 const &at = positions[agent];
+	glm::vec3 const &current = velocities[agent];
+	float const radius = radii[agent];
+	float const max_speed = max_speeds[agent];
+
+	//candidate velocities lie in the plane of the mesh here:
+	glm::vec3 up = mesh.world_normal(walk_points[agent]);
+	glm::vec3 preferred = preferred_velocities[agent];
+	preferred -= up * glm::dot(up, preferred);
+	float preferred_speed = glm::length(preferred);
+	if (preferred_speed > max_speed) {
+		preferred *= max_speed / preferred_speed;
+		preferred_speed = max_speed;
+	}
+
+	//gather the closest nearby agents (kept sorted by distance):
+	constexpr uint32_t MaxNeighbors = 16;
+	uint32_t neighbors[MaxNeighbors];
+	float neighbor_dis2[MaxNeighbors];
+	uint32_t neighbor_count = 0;
+	{
+		glm::ivec3 center = glm::ivec3(
+			int32_t(std::floor(at.x / neighbor_distance)),
+			int32_t(std::floor(at.y / neighbor_distance)),
+			int32_t(std::floor(at.z / neighbor_distance))
+		);
+		uint32_t visited[27];
+		uint32_t visited_count = 0;
+		for (int32_t dz = -1; dz <= 1; ++dz) {
+			for (int32_t dy = -1; dy <= 1; ++dy) {
+				for (int32_t dx = -1; dx <= 1; ++dx) {
+					uint32_t b = bucket(center + glm::ivec3(dx, dy, dz));
+					//(several cells can share a bucket)
+					if (std::find(visited, visited + visited_count, b) != visited + visited_count) continue;
+					visited[visited_count++] = b;
+					for (uint32_t i = cell_first[b]; i < cell_first[b+1]; ++i) {
+						uint32_t other = cell_agents[i];
+						if (other == agent) continue;
+						float dis2 = glm::length2(positions[other] - at);
+						if (dis2 > neighbor_distance * neighbor_distance) continue;
+						if (neighbor_count == MaxNeighbors) {
+							if (dis2 >= neighbor_dis2[MaxNeighbors-1]) continue;
+							neighbor_count -= 1; //drop the farthest
+						}
+						uint32_t n = neighbor_count++;
+						while (n > 0 && neighbor_dis2[n-1] > dis2) {
+							neighbors[n] = neighbors[n-1];
+							neighbor_dis2[n] = neighbor_dis2[n-1];
+							n -= 1;
+						}
+						neighbors[n] = other;
+						neighbor_dis2[n] = dis2;
+					}
+				}
+			}
+		}
+	}
+	if (neighbor_count == 0) return preferred;
+
+	//score a candidate by how far it is from 'preferred' and how soon it leads to a collision:
+	// (the relative velocity assumes the other agent takes half the responsibility for avoiding, as in reciprocal velocity obstacles)
+	auto penalty = [&](glm::vec3 const &v) {
+		float first_hit = std::numeric_limits< float >::infinity();
+		for (uint32_t n = 0; n < neighbor_count; ++n) {
+			uint32_t other = neighbors[n];
+			glm::vec3 to = positions[other] - at;
+			glm::vec3 closing = 2.0f * v - current - velocities[other];
+			float r = radius + radii[other];
+			float c = glm::dot(to, to) - r * r;
+			float b = glm::dot(to, closing);
+			if (c < 0.0f) {
+				//already overlapping, so anything short of moving apart is as bad as it gets:
+				if (b >= 0.0f) {
+					first_hit = 0.0f;
+					break;
+				}
+				continue;
+			}
+			if (b <= 0.0f) continue; //moving apart
+			float a = glm::dot(closing, closing);
+			float disc = b * b - a * c;
+			if (disc <= 0.0f) continue; //passing by
+			first_hit = std::min(first_hit, (b - std::sqrt(disc)) / a);
+		}
+		float score = glm::length(v - preferred);
+		if (first_hit < time_horizon) {
+			score += avoidance_weight / std::max(first_hit, 1e-3f);
+		}
+		return score;
+	};
+
+	glm::vec3 best = preferred;
+	float best_penalty = penalty(preferred);
+	if (best_penalty == 0.0f) return preferred; //no collision coming up, so nothing can do better
+	auto consider = [&](glm::vec3 const &v) {
+		float p = penalty(v);
+		if (p < best_penalty) {
+			best_penalty = p;
+			best = v;
+		}
+	};
+
+	glm::vec3 current_planar = current - up * glm::dot(up, current);
+	consider(current_planar);
+	consider(glm::vec3(0.0f));
+
+	//rings of velocities around the agent, starting from the preferred direction:
+	glm::vec3 forward = (preferred_speed > 1e-6f ? preferred / preferred_speed : glm::vec3(0.0f));
+	if (preferred_speed <= 1e-6f) {
+		forward = glm::cross(up, (std::abs(up.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f)));
+		forward = glm::normalize(forward);
+	}
+	glm::vec3 right = glm::cross(forward, up);
+	constexpr uint32_t Directions = 12;
+	for (uint32_t d = 1; d < Directions; ++d) {
+		float angle = d * (2.0f * 3.14159265f / Directions);
+		glm::vec3 dir = std::cos(angle) * forward + std::sin(angle) * right;
+		consider(dir * max_speed);
+		consider(dir * (0.5f * max_speed));
+	}
+	consider(forward * max_speed);
+	consider(forward * (0.5f * max_speed));
+
+	return best;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "WalkMesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+//"WalkCrowd" moves a group of agents over a WalkMesh, adjusting each agent's velocity so it doesn't walk through the others.
+// Game code sets each agent's preferred velocity (e.g., from a WalkFlowField or find_path) and calls update() once per tick.
+struct WalkCrowd {
+	//the crowd refers to (but does not own) its mesh:
+	WalkCrowd(WalkMesh const &mesh);
+
+	WalkMesh const &mesh;
+
+	//agents are stored as parallel arrays; add_agent returns the new agent's index:
+	uint32_t add_agent(WalkMesh::WalkPoint const &at, float radius = 0.3f, float max_speed = 1.5f);
+	//removing an agent moves the last agent into its index:
+	void remove_agent(uint32_t agent);
+
+	std::vector< WalkMesh::WalkPoint > walk_points;
+	std::vector< glm::vec3 > preferred_velocities; //set these before calling update()
+	std::vector< glm::vec3 > velocities; //velocity chosen by the last update()
+	std::vector< float > radii;
+	std::vector< float > max_speeds;
+
+	//avoidance settings:
+	float neighbor_distance = 3.0f; //only agents closer than this are avoided (also the size of hash cells)
+	float time_horizon = 2.0f; //collisions further off than this (in seconds) are ignored
+	float avoidance_weight = 1.0f; //trade-off between keeping to preferred velocity and avoiding collisions
+
+	//choose new velocities and walk every agent along its velocity for 'elapsed' seconds:
+	// (velocity choice is split across threads for big crowds)
+	void update(float elapsed);
+	static constexpr size_t MinAgentsPerThread = 256;
+
+	//world-space positions as of the start of the last update(), hashed into cells:
+	// (agents in hash bucket b are cell_agents[cell_first[b]] ... cell_agents[cell_first[b+1]-1])
+	std::vector< glm::vec3 > positions;
+	std::vector< uint32_t > cell_first;
+	std::vector< uint32_t > cell_agents;
+
+	//internals:
+	void rebuild_hash();
+	uint32_t bucket(glm::ivec3 const &cell) const;
+	glm::vec3 choose_velocity(uint32_t agent) const;
+	std::vector< glm::vec3 > new_velocities;
+	std::vector< glm::vec3 > steps;
+};
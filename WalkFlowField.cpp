@@ -0,0 +1,260 @@
+#include "WalkFlowField.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+//distances shifted by reroot() may be off by float rounding; ignore routes that are only shorter by this much:
+static constexpr const float RoundingSlack = 1e-4f;
+
+WalkFlowField::WalkFlowField(WalkMesh const &mesh_) : mesh(mesh_) {
+	distances.assign(mesh.triangles.size(), std::numeric_limits< float >::infinity());
+	next.assign(mesh.triangles.size(), -1U);
+	sources.assign(mesh.triangles.size(), -1U);
+	targets.assign(mesh.centers.begin(), mesh.centers.end());
+}
+
+uint32_t WalkFlowField::add_goal(WalkMesh::WalkPoint const &at) {
+	assert(at.index < mesh.triangles.size());
+
+	//re-use the slot of a removed goal, if there is one:
+	uint32_t goal = 0;
+	while (goal < goals.size() && goals[goal].active) ++goal;
+	if (goal == goals.size()) goals.emplace_back();
+
+	goals[goal].at = at;
+	goals[goal].active = true;
+	settled = 0;
+	seed(goal);
+	propagate();
+
+	return goal;
+}
+
+void WalkFlowField::move_goal(uint32_t goal, WalkMesh::WalkPoint const &at) {
+	assert(goal < goals.size() && goals[goal].active);
+	assert(at.index < mesh.triangles.size());
+
+	if (at.index == goals[goal].at.index) {
+		//still in the same triangle, so only the target there changes:
+		goals[goal].at = at;
+		if (sources[at.index] == goal) {
+			targets[at.index] = mesh.world_point(at);
+		}
+		return;
+	}
+
+	settled = 0;
+	if (sources[goals[goal].at.index] == goal && sources[at.index] == goal) {
+		//moving within its own basin (the usual case for small moves), so re-use the goal's routes:
+		goals[goal].at = at;
+		reroot(goal);
+		seed_goals();
+		propagate(RoundingSlack);
+	} else {
+		clear_basin(goal);
+		goals[goal].at = at;
+		seed_goals();
+		propagate();
+	}
+}
+
+void WalkFlowField::remove_goal(uint32_t goal) {
+	assert(goal < goals.size() && goals[goal].active);
+
+	goals[goal].active = false;
+	settled = 0;
+	clear_basin(goal);
+	seed_goals();
+	propagate();
+}
+
+void WalkFlowField::refresh(uint32_t triangle) {
+	assert(triangle < mesh.triangles.size());
+
+	settled = 0;
+	clear_upstream(triangle);
+	seed_goals();
+	propagate();
+}
+
+glm::vec3 WalkFlowField::direction(WalkMesh::WalkPoint const &wp) const {
+	assert(wp.index < mesh.triangles.size());
+	uint32_t t = wp.index;
+	if (sources[t] == -1U) return glm::vec3(0.0f);
+
+	glm::vec3 at = mesh.world_point(wp);
+	glm::vec3 to = targets[t] - at;
+	if (glm::length2(to) < 1e-12f) {
+		//sitting right on the target; if that's a portal, aim past it:
+		if (next[t] == -1U) return glm::vec3(0.0f);
+		to = targets[next[t]] - at;
+		if (glm::length2(to) < 1e-12f) return glm::vec3(0.0f);
+	}
+	return glm::normalize(to);
+}
+
+void WalkFlowField::seed(uint32_t goal) {
+	uint32_t t = goals[goal].at.index;
+	//(if another goal already sits in this triangle, it keeps the triangle)
+	if (distances[t] > 0.0f && !mesh.blocked[t]) {
+		distances[t] = 0.0f;
+		next[t] = -1U;
+		sources[t] = goal;
+		targets[t] = mesh.world_point(goals[goal].at);
+		open.emplace_back(0.0f, t);
+		std::push_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+	}
+}
+
+void WalkFlowField::seed_goals() {
+	for (uint32_t goal = 0; goal < goals.size(); ++goal) {
+		if (goals[goal].active) seed(goal);
+	}
+}
+
+void WalkFlowField::clear_basin(uint32_t goal) {
+	uint32_t start = goals[goal].at.index;
+	if (sources[start] != goal) return; //goal shares a triangle with another goal, so nothing was heading to it
+	//(everything heading to the goal passes through its triangle)
+	clear_upstream(start);
+}
+
+void WalkFlowField::clear_upstream(uint32_t start) {
+	auto clear = [this](uint32_t t) {
+		distances[t] = std::numeric_limits< float >::infinity();
+		next[t] = -1U;
+		sources[t] = -1U;
+		targets[t] = mesh.centers[t];
+		cleared.emplace_back(t);
+	};
+
+	//walk backward along 'next' from the start triangle to find everything that was heading through it:
+	cleared.clear();
+	clear(start);
+	for (uint32_t i = 0; i < cleared.size(); ++i) {
+		uint32_t t = cleared[i];
+		for (uint32_t k = 0; k < 3; ++k) {
+			uint32_t n = mesh.adjacent[t][k];
+			if (n != -1U && sources[n] != -1U && next[n] == t) {
+				clear(n);
+			}
+		}
+	}
+
+	//cleared triangles next to ones heading elsewhere can head there too:
+	for (uint32_t t : cleared) {
+		if (mesh.blocked[t]) continue;
+		for (uint32_t k = 0; k < 3; ++k) {
+			uint32_t n = mesh.adjacent[t][k];
+			if (n == -1U || sources[n] == -1U || mesh.blocked[n]) continue;
+			float d = distances[n] + glm::length(mesh.centers[n] - mesh.centers[t]);
+			if (d < distances[t]) {
+				distances[t] = d;
+				next[t] = n;
+				sources[t] = sources[n];
+				targets[t] = mesh.portal_midpoints[3*t+k];
+			}
+		}
+		if (sources[t] != -1U) {
+			open.emplace_back(distances[t], t);
+			std::push_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+		}
+	}
+}
+
+void WalkFlowField::reroot(uint32_t goal) {
+	uint32_t root = goals[goal].at.index;
+	assert(sources[root] == goal);
+
+	//the path from the new root back along 'next' to the old root gets reversed:
+	// (a sub-path of a shortest path is a shortest path, so the new distances along it are exact)
+	path.clear();
+	for (uint32_t t = root; t != -1U; t = next[t]) {
+		path.emplace_back(t, distances[t]);
+	}
+	float shift = distances[root];
+
+	//every other triangle heading to the goal joins the path at some path triangle,
+	// and its distance changes by as much as that triangle's does:
+	// (these routes are still valid, but the ones behind the old root may no longer be the shortest)
+	cleared.clear();
+	for (uint32_t i = 0; i < path.size(); ++i) {
+		uint32_t p = path[i].first;
+		float delta = (shift - path[i].second) - path[i].second;
+		uint32_t begin = uint32_t(cleared.size());
+		cleared.emplace_back(p);
+		for (uint32_t c = begin; c < cleared.size(); ++c) {
+			uint32_t t = cleared[c];
+			for (uint32_t k = 0; k < 3; ++k) {
+				uint32_t n = mesh.adjacent[t][k];
+				if (n == -1U || sources[n] != goal || next[n] != t) continue;
+				if (i > 0 && n == path[i-1].first) continue; //(the path itself)
+				distances[n] += delta;
+				cleared.emplace_back(n);
+			}
+		}
+	}
+
+	//now reverse the path:
+	distances[root] = 0.0f;
+	next[root] = -1U;
+	targets[root] = mesh.world_point(goals[goal].at);
+	for (uint32_t i = 1; i < path.size(); ++i) {
+		uint32_t t = path[i].first;
+		uint32_t n = path[i-1].first;
+		glm::uvec3 const &adj = mesh.adjacent[t];
+		uint32_t k = (adj.x == n ? 0 : (adj.y == n ? 1 : 2));
+		distances[t] = shift - path[i].second;
+		next[t] = n;
+		targets[t] = mesh.portal_midpoints[3*t+k];
+	}
+
+	//queue up the triangles that now have a shorter route than the one they are on:
+	// (edges between triangles whose distances shifted by the same amount are still consistent, but checking
+	//  every edge is as cheap as working out which ones those are)
+	for (uint32_t t : cleared) {
+		for (uint32_t k = 0; k < 3; ++k) {
+			uint32_t n = mesh.adjacent[t][k];
+			if (n == -1U || mesh.blocked[n]) continue;
+			float length = glm::length(mesh.centers[n] - mesh.centers[t]);
+			if (sources[n] != -1U && distances[n] + length < distances[t] - RoundingSlack) {
+				reach(t, n, distances[n] + length);
+			} else if (distances[t] + length < distances[n] - RoundingSlack) {
+				reach(n, t, distances[t] + length);
+			}
+		}
+	}
+}
+
+void WalkFlowField::reach(uint32_t t, uint32_t from, float d) {
+	distances[t] = d;
+	next[t] = from;
+	sources[t] = sources[from];
+	//t heads through its edge shared with 'from':
+	glm::uvec3 const &adj = mesh.adjacent[t];
+	uint32_t k = (adj.x == from ? 0 : (adj.y == from ? 1 : 2));
+	targets[t] = mesh.portal_midpoints[3*t+k];
+	open.emplace_back(d, t);
+	std::push_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+}
+
+void WalkFlowField::propagate(float slack) {
+	while (!open.empty()) {
+		std::pop_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+		float d = open.back().first;
+		uint32_t t = open.back().second;
+		open.pop_back();
+		if (d > distances[t]) continue; //stale entry; t was reached more cheaply since
+		settled += 1;
+
+		for (uint32_t k = 0; k < 3; ++k) {
+			uint32_t n = mesh.adjacent[t][k];
+			if (n == -1U || mesh.blocked[n]) continue;
+			float nd = d + glm::length(mesh.centers[n] - mesh.centers[t]);
+			if (nd < distances[n] - slack) reach(n, t, nd);
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "WalkMesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <utility>
+#include <vector>
+
+//"WalkFlowField" steers any number of agents toward the nearest of a set of goals on a WalkMesh.
+// It stores, per triangle, the distance to the closest goal and where to head next,
+// so looking up an agent's direction doesn't depend on how many agents or goals there are.
+struct WalkFlowField {
+	//the field refers to (but does not own) its mesh:
+	WalkFlowField(WalkMesh const &mesh);
+
+	WalkMesh const &mesh;
+
+	//goals are identified by the index returned from add_goal:
+	uint32_t add_goal(WalkMesh::WalkPoint const &at);
+	//moving a goal to a triangle that was heading to it keeps the existing routes (extended along the way between
+	// its old and new triangles) and only re-routes triangles that now have a shorter way to the goal;
+	// other moves recompute the triangles that were heading to the goal:
+	// (and moving within the same triangle costs nothing)
+	void move_goal(uint32_t goal, WalkMesh::WalkPoint const &at);
+	void remove_goal(uint32_t goal);
+
+	//update the field after the mesh's set_blocked or patch_vertices changed a triangle:
+	// (only triangles that were heading through it are recomputed)
+	void refresh(uint32_t triangle);
+
+	//unit-length direction (in the plane of wp's triangle) to walk from wp toward the closest goal:
+	// (zero if wp is at a goal or no goal can be reached)
+	glm::vec3 direction(WalkMesh::WalkPoint const &wp) const;
+
+	//distance along the mesh from the center of wp's triangle to the closest goal:
+	// (infinity if no goal can be reached)
+	float distance(WalkMesh::WalkPoint const &wp) const {
+		return distances[wp.index];
+	}
+
+	struct Goal {
+		WalkMesh::WalkPoint at;
+		bool active = false;
+	};
+	std::vector< Goal > goals;
+
+	//per-triangle field:
+	std::vector< float > distances; //distance from the triangle's center to the closest goal
+	std::vector< uint32_t > next; //adjacent triangle to head to (-1U in goal triangles and unreachable ones)
+	std::vector< uint32_t > sources; //goal the triangle is heading to (-1U if unreachable)
+	std::vector< glm::vec3 > targets; //point to head toward -- portal midpoint toward 'next' or goal position
+
+	//triangles settled (taken off the queue) by the last add_goal, move_goal, remove_goal or refresh, for profiling:
+	uint32_t settled = 0;
+
+	//internals:
+	void seed(uint32_t goal); //mark a goal's triangle as distance zero and queue it
+	void seed_goals(); //seed every active goal whose triangle isn't already at distance zero
+	void clear_basin(uint32_t goal); //mark triangles heading to 'goal' unreachable and queue them for recomputation
+	void clear_upstream(uint32_t triangle); //same, for triangles heading through 'triangle' (and the triangle itself)
+	void reroot(uint32_t goal); //after a goal moved to a triangle heading to it: reverse the route between its old and new triangles, and queue triangles with shorter routes
+	void reach(uint32_t triangle, uint32_t from, float distance); //head 'triangle' through adjacent triangle 'from' and queue it
+	void propagate(float slack = 0.0f); //run Dijkstra from the queued triangles (ignoring improvements of 'slack' or less)
+	std::vector< std::pair< float, uint32_t > > open; //queue, as a heap on distance
+	std::vector< uint32_t > cleared; //scratch list used by clear_basin and reroot
+	std::vector< std::pair< uint32_t, float > > path; //scratch list used by reroot (triangle, old distance)
+};
@@ -1,27 +1,69 @@
 #include "WalkMesh.hpp"
 
 #include "read_chunk.hpp"
+#include "write_chunk.hpp"
+#include "WorkerPool.hpp"
 
 #include <glm/gtx/norm.hpp>
 
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <functional>
 #include <string>
 
 WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_)
 	: vertices(vertices_), normals(normals_), triangles(triangles_) {
 
-	//construct next_vertex map (maps each edge to the next vertex in the triangle):
-	next_vertex.reserve(triangles.size()*3);
-	auto do_next = [this](uint32_t a, uint32_t b, uint32_t c) {
-		auto ret = next_vertex.insert(std::make_pair(glm::uvec2(a,b), c));
-		assert(ret.second);
-	};
-	for (auto const &tri : triangles) {
-		do_next(tri.x, tri.y, tri.z);
-		do_next(tri.y, tri.z, tri.x);
-		do_next(tri.z, tri.x, tri.y);
+	{ //construct adjacency by matching each edge [a,b] with edge [b,a] from another triangle:
+		//list edges by starting vertex -- edges starting at v are (edge_to[i], edge_id[i]) for i in [edge_first[v], edge_first[v+1]):
+		// (edge_id is 3 * triangle + the index of the vertex opposite the edge)
+		std::vector< uint32_t > edge_first(vertices.size() + 1, 0);
+		for (auto const &tri : triangles) {
+			edge_first[tri.x+1] += 1;
+			edge_first[tri.y+1] += 1;
+			edge_first[tri.z+1] += 1;
+		}
+		for (uint32_t v = 1; v < edge_first.size(); ++v) {
+			edge_first[v] += edge_first[v-1];
+		}
+		std::vector< uint32_t > edge_to(edge_first.back());
+		std::vector< uint32_t > edge_id(edge_first.back());
+		std::vector< uint32_t > next(edge_first.begin(), edge_first.end() - 1);
+		auto add_edge = [&](uint32_t a, uint32_t b, uint32_t id) {
+			edge_to[next[a]] = b;
+			edge_id[next[a]] = id;
+			next[a] += 1;
+		};
+		for (uint32_t ti = 0; ti < triangles.size(); ++ti) {
+			glm::uvec3 const &tri = triangles[ti];
+			add_edge(tri.y, tri.z, 3*ti+0);
+			add_edge(tri.z, tri.x, 3*ti+1);
+			add_edge(tri.x, tri.y, 3*ti+2);
+		}
+
+		//returns the edge id of [a,b], or -1U if no triangle has that edge:
+		auto find_edge = [&](uint32_t a, uint32_t b) {
+			uint32_t found = -1U;
+			for (uint32_t i = edge_first[a]; i < edge_first[a+1]; ++i) {
+				if (edge_to[i] == b) {
+					assert(found == -1U); //each edge should only appear once
+					found = edge_id[i];
+				}
+			}
+			return found;
+		};
+
+		adjacent.assign(triangles.size(), glm::uvec3(-1U));
+		for (uint32_t ti = 0; ti < triangles.size(); ++ti) {
+			glm::uvec3 const &tri = triangles[ti];
+			glm::uvec3 across = glm::uvec3(find_edge(tri.z, tri.y), find_edge(tri.x, tri.z), find_edge(tri.y, tri.x));
+			adjacent[ti] = glm::uvec3(
+				across.x == -1U ? -1U : across.x / 3,
+				across.y == -1U ? -1U : across.y / 3,
+				across.z == -1U ? -1U : across.z / 3
+			);
+		}
 	}
 
 	//DEBUG: are vertex normals consistent with geometric normals?
@@ -37,12 +79,230 @@ WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::
 
 		assert(da > 0.1f && db > 0.1f && dc > 0.1f);
 	}
+
+	//build per-triangle portal graph and step data:
+	centers.resize(triangles.size());
+	portal_midpoints.resize(3 * triangles.size());
+	step_to_weights.resize(triangles.size());
+	for (uint32_t ti = 0; ti < triangles.size(); ++ti) {
+		update_triangle(ti);
+	}
+	blocked.assign(triangles.size(), 0);
+	path_cache.reset(new PathCache);
+	path_cache->entries.resize(PathCacheSize);
+
+	rebuild_grid();
+}
+
+void WalkMesh::update_triangle(uint32_t ti) {
+	glm::uvec3 const &tri = triangles[ti];
+	glm::vec3 const &a = vertices[tri.x];
+	glm::vec3 const &b = vertices[tri.y];
+	glm::vec3 const &c = vertices[tri.z];
+
+	centers[ti] = (a + b + c) / 3.0f;
+	portal_midpoints[3*ti+0] = 0.5f * (b + c);
+	portal_midpoints[3*ti+1] = 0.5f * (c + a);
+	portal_midpoints[3*ti+2] = 0.5f * (a + b);
+
+	//step-to-barycentric matrix:
+	// (projecting a step onto the triangle's plane and measuring signed areas, as in start(), is linear in the step;
+	//  the out-of-plane part of the step drops out of the triple products, leaving rows cross(out, edge) / (2 * area)^2)
+	glm::vec3 out = glm::cross(b-a, c-a);
+	float area2 = glm::dot(out, out);
+	step_to_weights[ti] = glm::transpose(glm::mat3(
+		glm::cross(out, c-b) / area2,
+		glm::cross(out, a-c) / area2,
+		glm::cross(out, b-a) / area2
+	));
+}
+
+//turn a grid's packed 'first' offsets (one per cell, plus the end) into per-cell first/count/capacity:
+static void finish_grid(WalkMesh::Grid &grid) {
+	uint32_t cells = uint32_t(grid.first.size()) - 1;
+	grid.count.resize(cells);
+	for (uint32_t c = 0; c < cells; ++c) {
+		grid.count[c] = grid.first[c+1] - grid.first[c];
+	}
+	grid.capacity = grid.count;
+	grid.first.pop_back();
+}
+
+void WalkMesh::rebuild_grid() {
+	grid.first.clear();
+	grid.count.clear();
+	grid.capacity.clear();
+	grid.triangles.clear();
+	if (!triangles.empty()) {
+		//bounds of the mesh and typical triangle size:
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		float mean_extent = 0.0f;
+		for (auto const &tri : triangles) {
+			glm::vec3 tri_min = glm::min(vertices[tri.x], glm::min(vertices[tri.y], vertices[tri.z]));
+			glm::vec3 tri_max = glm::max(vertices[tri.x], glm::max(vertices[tri.y], vertices[tri.z]));
+			min = glm::min(min, tri_min);
+			max = glm::max(max, tri_max);
+			glm::vec3 extent = tri_max - tri_min;
+			mean_extent += std::max(extent.x, std::max(extent.y, extent.z));
+		}
+		mean_extent /= float(triangles.size());
+		glm::vec3 extent = max - min;
+
+		//cells about the size of a triangle, but not so many that most of them are empty:
+		grid.min = min;
+		grid.cell = std::max(mean_extent, 1e-4f * std::max(extent.x, std::max(extent.y, std::max(extent.z, 1.0f))));
+		uint32_t const MaxCells = 4 * uint32_t(triangles.size()) + 64;
+		while (true) {
+			grid.size = glm::uvec3(
+				uint32_t(extent.x / grid.cell) + 1,
+				uint32_t(extent.y / grid.cell) + 1,
+				uint32_t(extent.z / grid.cell) + 1
+			);
+			if (uint64_t(grid.size.x) * grid.size.y * grid.size.z <= MaxCells) break;
+			grid.cell *= 1.5f;
+		}
+
+		//bucket triangles into cells (count, then prefix sum, then fill):
+		auto for_each_cell = [this](glm::uvec3 const &tri, std::function< void(uint32_t) > const &fn) {
+			glm::uvec3 lo = grid.cell_of(glm::min(vertices[tri.x], glm::min(vertices[tri.y], vertices[tri.z])));
+			glm::uvec3 hi = grid.cell_of(glm::max(vertices[tri.x], glm::max(vertices[tri.y], vertices[tri.z])));
+			for (uint32_t z = lo.z; z <= hi.z; ++z) {
+				for (uint32_t y = lo.y; y <= hi.y; ++y) {
+					for (uint32_t x = lo.x; x <= hi.x; ++x) {
+						fn(grid.index(glm::uvec3(x,y,z)));
+					}
+				}
+			}
+		};
+		grid.first.assign(grid.size.x * grid.size.y * grid.size.z + 1, 0);
+		for (auto const &tri : triangles) {
+			for_each_cell(tri, [this](uint32_t c) { grid.first[c+1] += 1; });
+		}
+		for (uint32_t c = 1; c < grid.first.size(); ++c) {
+			grid.first[c] += grid.first[c-1];
+		}
+		grid.triangles.resize(grid.first.back());
+		std::vector< uint32_t > next(grid.first.begin(), grid.first.end() - 1);
+		for (uint32_t ti = 0; ti < triangles.size(); ++ti) {
+			for_each_cell(triangles[ti], [this,&next,ti](uint32_t c) { grid.triangles[next[c]++] = ti; });
+		}
+		finish_grid(grid);
+	}
+}
+
+//grid parameters, as stored in baked files:
+struct BakedGrid {
+	glm::vec3 min;
+	float cell;
+	glm::uvec3 size;
+};
+static_assert(sizeof(BakedGrid) == 28, "BakedGrid is packed.");
+
+WalkMesh::WalkMesh(std::istream &from) {
+	read_chunk(from, "p...", &vertices);
+	read_chunk(from, "n...", &normals);
+	read_chunk(from, "tri0", &triangles);
+	read_chunk(from, "adj0", &adjacent);
+	read_chunk(from, "stw0", &step_to_weights);
+	read_chunk(from, "ctr0", &centers);
+	read_chunk(from, "mid0", &portal_midpoints);
+
+	std::vector< BakedGrid > baked_grid;
+	read_chunk(from, "grd0", &baked_grid);
+	read_chunk(from, "grf0", &grid.first);
+	read_chunk(from, "grt0", &grid.triangles);
+
+	//sizes should agree (contents are trusted -- they were checked when the mesh was built):
+	if (normals.size() != vertices.size()
+	 || adjacent.size() != triangles.size()
+	 || step_to_weights.size() != triangles.size()
+	 || centers.size() != triangles.size()
+	 || portal_midpoints.size() != 3 * triangles.size()
+	 || baked_grid.size() != 1) {
+		throw std::runtime_error("Mis-matched array sizes in baked walkmesh.");
+	}
+	grid.min = baked_grid[0].min;
+	grid.cell = baked_grid[0].cell;
+	grid.size = baked_grid[0].size;
+	if (!triangles.empty() && (grid.first.size() != grid.size.x * grid.size.y * grid.size.z + 1 || grid.first.back() != grid.triangles.size())) {
+		throw std::runtime_error("Mis-matched grid size in baked walkmesh.");
+	}
+	if (!grid.first.empty()) finish_grid(grid);
+
+	blocked.assign(triangles.size(), 0);
+	path_cache.reset(new PathCache);
+	path_cache->entries.resize(PathCacheSize);
+}
+
+void WalkMesh::save(std::ostream &to) const {
+	write_chunk(to, "p...", vertices);
+	write_chunk(to, "n...", normals);
+	write_chunk(to, "tri0", triangles);
+	write_chunk(to, "adj0", adjacent);
+	write_chunk(to, "stw0", step_to_weights);
+	write_chunk(to, "ctr0", centers);
+	write_chunk(to, "mid0", portal_midpoints);
+
+	std::vector< BakedGrid > baked_grid(1);
+	baked_grid[0].min = grid.min;
+	baked_grid[0].cell = grid.cell;
+	baked_grid[0].size = grid.size;
+	write_chunk(to, "grd0", baked_grid);
+
+	//grid cells are stored packed, without the spare room (or cells moved by patch_vertices):
+	std::vector< uint32_t > packed_first;
+	std::vector< uint32_t > packed_triangles;
+	if (!grid.first.empty()) {
+		packed_first.reserve(grid.first.size() + 1);
+		for (uint32_t c = 0; c < grid.first.size(); ++c) {
+			packed_first.emplace_back(uint32_t(packed_triangles.size()));
+			packed_triangles.insert(packed_triangles.end(), grid.triangles.begin() + grid.first[c], grid.triangles.begin() + grid.first[c] + grid.count[c]);
+		}
+		packed_first.emplace_back(uint32_t(packed_triangles.size()));
+	}
+	write_chunk(to, "grf0", packed_first);
+	write_chunk(to, "grt0", packed_triangles);
+}
+
+void WalkMesh::Grid::add(uint32_t c, uint32_t triangle) {
+	if (count[c] == capacity[c]) {
+		//out of room; move the cell to the end of the list with room to grow:
+		uint32_t at = uint32_t(triangles.size());
+		uint32_t room = std::max(4U, 2 * capacity[c]);
+		triangles.resize(at + room);
+		std::copy(triangles.begin() + first[c], triangles.begin() + first[c] + count[c], triangles.begin() + at);
+		first[c] = at;
+		capacity[c] = room;
+	}
+	triangles[first[c] + count[c]] = triangle;
+	count[c] += 1;
+}
+
+void WalkMesh::Grid::remove(uint32_t c, uint32_t triangle) {
+	uint32_t *begin = triangles.data() + first[c];
+	uint32_t *end = begin + count[c];
+	uint32_t *at = std::find(begin, end, triangle);
+	assert(at != end);
+	*at = *(end - 1);
+	count[c] -= 1;
+}
+
+glm::uvec3 WalkMesh::Grid::cell_of(glm::vec3 const &pt) const {
+	glm::vec3 f = (pt - min) / cell;
+	return glm::uvec3(
+		uint32_t(std::max(0.0f, std::min(f.x, float(size.x - 1)))),
+		uint32_t(std::max(0.0f, std::min(f.y, float(size.y - 1)))),
+		uint32_t(std::max(0.0f, std::min(f.z, float(size.z - 1))))
+	);
 }
 
 WalkMesh::WalkPoint WalkMesh::start(glm::vec3 const &world_point) const {
 	WalkPoint closest;
 	float closest_dis2 = std::numeric_limits< float >::infinity();
-	for (auto const &tri : triangles) {
+	auto check_triangle = [&world_point, &closest, &closest_dis2, this](uint32_t ti) {
+		if (blocked[ti]) return;
+		glm::uvec3 const &tri = triangles[ti];
 		glm::vec3 const &a = vertices[tri.x];
 		glm::vec3 const &b = vertices[tri.y];
 		glm::vec3 const &c = vertices[tri.z];
@@ -50,7 +310,7 @@ WalkMesh::WalkPoint WalkMesh::start(glm::vec3 const &world_point) const {
 		//figure out barycentric coordinates for point:
 		//project to plane of triangle:
 		glm::vec3 out = glm::cross(b-a, c-a);
-		glm::vec3 pt = world_point - out * (glm::dot(out, world_point) / glm::dot(out, out));
+		glm::vec3 pt = world_point - out * (glm::dot(out, world_point - a) / glm::dot(out, out));
 
 		//figure out barycentric coordinates using signed triangle areas:
 		glm::vec3 coords = glm::vec3(
@@ -65,49 +325,91 @@ WalkMesh::WalkPoint WalkMesh::start(glm::vec3 const &world_point) const {
 			float dis2 = glm::length2(world_point - pt);
 			if (dis2 < closest_dis2) {
 				closest_dis2 = dis2;
+				closest.index = ti;
 				closest.triangle = tri;
 				closest.weights = coords;
 			}
 		} else {
 			//check triangle vertices and edges:
-			auto check_edge = [&world_point, &closest, &closest_dis2, this](uint32_t ai, uint32_t bi, uint32_t ci) {
-				glm::vec3 const &a = vertices[ai];
-				glm::vec3 const &b = vertices[bi];
+			// (edge from tri[ai] to tri[bi])
+			auto check_edge = [&world_point, &closest, &closest_dis2, &tri, ti, this](int ai, int bi) {
+				glm::vec3 const &a = vertices[tri[ai]];
+				glm::vec3 const &b = vertices[tri[bi]];
 
 				//find closest point on line segment ab:
 				float along = glm::dot(world_point-a, b-a);
 				float max = glm::dot(b-a, b-a);
 				glm::vec3 pt;
-				glm::vec3 coords;
+				float amt;
 				if (along < 0.0f) {
 					pt = a;
-					coords = glm::vec3(1.0f, 0.0f, 0.0f);
+					amt = 0.0f;
 				} else if (along > max) {
 					pt = b;
-					coords = glm::vec3(0.0f, 1.0f, 0.0f);
+					amt = 1.0f;
 				} else {
-					float amt = along / max;
+					amt = along / max;
 					pt = glm::mix(a, b, amt);
-					coords = glm::vec3(1.0f - amt, amt, 0.0f);
 				}
 
 				float dis2 = glm::length2(world_point - pt);
 				if (dis2 < closest_dis2) {
 					closest_dis2 = dis2;
-					closest.triangle = glm::uvec3(ai, bi, ci);
-					closest.weights = coords;
+					closest.index = ti;
+					closest.triangle = tri;
+					closest.weights = glm::vec3(0.0f);
+					closest.weights[ai] = 1.0f - amt;
+					closest.weights[bi] = amt;
 				}
 			};
-			check_edge(tri.x, tri.y, tri.z);
-			check_edge(tri.y, tri.z, tri.x);
-			check_edge(tri.z, tri.x, tri.y);
+			check_edge(0, 1);
+			check_edge(1, 2);
+			check_edge(2, 0);
+		}
+	};
+
+	if (grid.first.empty()) return closest;
+
+	//check triangles in rings of cells around the cell nearest world_point, until no closer point is possible:
+	glm::uvec3 center = grid.cell_of(world_point);
+	int32_t cx = center.x, cy = center.y, cz = center.z;
+	int32_t sx = grid.size.x, sy = grid.size.y, sz = grid.size.z;
+	int32_t max_ring = std::max(std::max(std::max(cx, sx-1-cx), std::max(cy, sy-1-cy)), std::max(cz, sz-1-cz));
+
+	auto check_cell = [&check_triangle, this](int32_t x, int32_t y, int32_t z) {
+		uint32_t c = grid.index(glm::uvec3(x,y,z));
+		for (uint32_t i = grid.first[c], end = i + grid.count[c]; i < end; ++i) {
+			check_triangle(grid.triangles[i]);
+		}
+	};
+
+	for (int32_t r = 0; r <= max_ring; ++r) {
+		//cells in ring r are at least (r-1) cells away from world_point (or its projection onto the grid):
+		if (r > 0) {
+			float ring_dis = (r - 1) * grid.cell;
+			if (ring_dis * ring_dis >= closest_dis2) break;
+		}
+		for (int32_t z = std::max(0, cz - r); z <= std::min(sz - 1, cz + r); ++z) {
+			for (int32_t y = std::max(0, cy - r); y <= std::min(sy - 1, cy + r); ++y) {
+				if (std::abs(z - cz) == r || std::abs(y - cy) == r) {
+					for (int32_t x = std::max(0, cx - r); x <= std::min(sx - 1, cx + r); ++x) {
+						check_cell(x, y, z);
+					}
+				} else {
+					if (cx - r >= 0) check_cell(cx - r, y, z);
+					if (cx + r < sx) check_cell(cx + r, y, z);
+				}
+			}
 		}
 	}
+
 	return closest;
 }
 
 void WalkMesh::walk(WalkMesh::WalkPoint &wp, glm::vec3 const &step) const {
 
+	assert(wp.index < triangles.size() && wp.triangle == triangles[wp.index]);
+
 	glm::vec3 remain = step;
 
 	uint32_t iter = 0;
@@ -118,34 +420,12 @@ void WalkMesh::walk(WalkMesh::WalkPoint &wp, glm::vec3 const &step) const {
 		}
 		iter += 1;
 
-		glm::vec3 remain_coords;
-		{ //project 'remain' to current triangle:
-			glm::vec3 const &a = vertices[wp.triangle.x];
-			glm::vec3 const &b = vertices[wp.triangle.y];
-			glm::vec3 const &c = vertices[wp.triangle.z];
-
-			//project to plane of triangle:
-			glm::vec3 out = glm::cross(b-a, c-a);
-			glm::vec3 pt = remain - out * (glm::dot(out, remain) / glm::dot(out, out));
-
-			assert(pt == pt); //pt isn't NaN, right?
-
-			//figure out barycentric coordinates for remain:
-			glm::vec3 coords = glm::vec3(
-				glm::dot(out, glm::cross(c-b, pt)),
-				glm::dot(out, glm::cross(a-c, pt)),
-				glm::dot(out, glm::cross(b-a, pt))
-			) / glm::dot(out, glm::cross(b-a, c-a));
-
-			assert(coords.x == coords.x && coords.y == coords.y && coords.z == coords.z); //riiiight?
-
-			remain_coords = coords;
-
-			assert(remain_coords.x == remain_coords.x); //remain_coords shouldn't be NaN
-		}
+		//barycentric coordinates for (the part of 'remain' in the plane of) the current triangle:
+		glm::vec3 remain_coords = step_to_weights[wp.index] * remain;
+		assert(remain_coords.x == remain_coords.x && remain_coords.y == remain_coords.y && remain_coords.z == remain_coords.z); //remain_coords shouldn't be NaN
 
 		float t = 1.0f;
-		glm::uvec2 edge = glm::uvec2(-1U); uint32_t other = -1U;
+		glm::uvec2 edge = glm::uvec2(-1U); uint32_t other = -1U; uint32_t across = -1U;
 		glm::vec2 edge_coords = glm::vec2(std::numeric_limits< float >::quiet_NaN());
 		{ //figure out when (if ever) and where an edge is crossed:
 			#define TEST_COORD( C, A, B ) \
@@ -153,7 +433,7 @@ void WalkMesh::walk(WalkMesh::WalkPoint &wp, glm::vec3 const &step) const {
 					float test = std::max(0.0f, -wp.weights.C / remain_coords.C); \
 					if (test < t) { \
 						t = test; \
-						edge = glm::uvec2(wp.triangle.A, wp.triangle.B); other = wp.triangle.C; \
+						edge = glm::uvec2(wp.triangle.A, wp.triangle.B); other = wp.triangle.C; across = adjacent[wp.index].C; \
 						edge_coords = glm::vec2(t * remain_coords.A + wp.weights.A, t * remain_coords.B + wp.weights.B); \
 					} \
 				}
@@ -178,8 +458,7 @@ void WalkMesh::walk(WalkMesh::WalkPoint &wp, glm::vec3 const &step) const {
 		remain *= (1.0f - t);
 
 		//is edge solid?
-		auto f = next_vertex.find(glm::uvec2(edge.y, edge.x));
-		if (f == next_vertex.end()) {
+		if (across == -1U || blocked[across]) {
 			//if yes, move remain to point (slightly) inward:
 			glm::vec3 along = glm::normalize(vertices[edge.y] - vertices[edge.x]);
 			glm::vec3 in = vertices[other] - vertices[edge.x];
@@ -192,18 +471,25 @@ void WalkMesh::walk(WalkMesh::WalkPoint &wp, glm::vec3 const &step) const {
 			//NOTE: this probably results in an infinite loop when walking into a corner.
 		} else {
 			//if no, move to new triangle:
-			assert(f->second != other);
+			glm::uvec3 const &tri = triangles[across];
 
-			//update triangle and weights:
-			wp.triangle = glm::uvec3(edge.y, edge.x, f->second);
-			wp.weights = glm::vec3(edge_coords.y, edge_coords.x, 0.0f);
+			//update triangle and weights (the new triangle shares edge.x and edge.y; its third vertex starts at weight zero):
+			wp.index = across;
+			wp.triangle = tri;
+			wp.weights = glm::vec3(
+				(tri.x == edge.x ? edge_coords.x : (tri.x == edge.y ? edge_coords.y : 0.0f)),
+				(tri.y == edge.x ? edge_coords.x : (tri.y == edge.y ? edge_coords.y : 0.0f)),
+				(tri.z == edge.x ? edge_coords.x : (tri.z == edge.y ? edge_coords.y : 0.0f))
+			);
+			uint32_t new_other = tri.x ^ tri.y ^ tri.z ^ edge.x ^ edge.y; //(xor cancels out the shared vertices)
+			assert(new_other != other);
 
 			//rotate 'remain' around edge:
 			glm::vec3 along = glm::normalize(vertices[edge.y] - vertices[edge.x]);
 			glm::vec3 to_old_other = vertices[other] - vertices[edge.x];
 			to_old_other = glm::normalize(to_old_other - along * glm::dot(along, to_old_other));
 
-			glm::vec3 to_new_other = vertices[f->second] - vertices[edge.y];
+			glm::vec3 to_new_other = vertices[new_other] - vertices[edge.y];
 			to_new_other = glm::normalize(to_new_other - along * glm::dot(along, to_new_other));
 
 			float d = glm::dot(remain, -to_old_other); //amount of 'remain' sticking out of old triangle
@@ -214,10 +500,536 @@ void WalkMesh::walk(WalkMesh::WalkPoint &wp, glm::vec3 const &step) const {
 	}
 }
 
+void WalkMesh::walk(WalkPoint *wps, glm::vec3 const *steps, size_t count) const {
+	//walk points [begin,end), a block of Lanes at a time:
+	auto walk_range = [this,wps,steps](size_t begin, size_t end) {
+		constexpr uint32_t Lanes = 8;
+		for (size_t base = begin; base < end; base += Lanes) {
+			uint32_t lanes = uint32_t(std::min< size_t >(Lanes, end - base));
+
+			//new weights if every point stays in its triangle:
+			// (written lane-by-lane over flat arrays so the compiler can vectorize it)
+			float wx[Lanes], wy[Lanes], wz[Lanes];
+			for (uint32_t l = 0; l < lanes; ++l) {
+				WalkPoint const &wp = wps[base + l];
+				assert(wp.index < triangles.size() && wp.triangle == triangles[wp.index]);
+				glm::mat3 const &m = step_to_weights[wp.index];
+				glm::vec3 const &s = steps[base + l];
+				wx[l] = wp.weights.x + m[0].x * s.x + m[1].x * s.y + m[2].x * s.z;
+				wy[l] = wp.weights.y + m[0].y * s.x + m[1].y * s.y + m[2].y * s.z;
+				wz[l] = wp.weights.z + m[0].z * s.x + m[1].z * s.y + m[2].z * s.z;
+			}
+			bool inside[Lanes];
+			for (uint32_t l = 0; l < lanes; ++l) {
+				inside[l] = (wx[l] >= 0.0f) & (wy[l] >= 0.0f) & (wz[l] >= 0.0f);
+			}
+
+			//keep the points that stayed inside; the rest take the edge-crossing path:
+			for (uint32_t l = 0; l < lanes; ++l) {
+				if (inside[l]) {
+					wps[base + l].weights = glm::vec3(wx[l], wy[l], wz[l]);
+				} else {
+					walk(wps[base + l], steps[base + l]);
+				}
+			}
+		}
+	};
+
+	split_across_threads(count, MinWalkPointsPerThread, walk_range);
+}
+
+//calls fn(cell, t_exit) for each grid cell the ray origin + t * direction passes through for t in [0, max_t], in order:
+// (t_exit is where the ray leaves the cell; stops early if fn returns false)
+template< typename F >
+static void for_cells_along(WalkMesh::Grid const &grid, glm::vec3 const &origin, glm::vec3 const &direction, float max_t, F const &fn) {
+	if (grid.first.empty()) return;
+
+	//clip ray to the grid's bounds:
+	float t_enter = 0.0f;
+	float t_exit = max_t;
+	for (int i = 0; i < 3; ++i) {
+		float lo = grid.min[i];
+		float hi = grid.min[i] + grid.size[i] * grid.cell;
+		if (direction[i] == 0.0f) {
+			if (origin[i] < lo || origin[i] > hi) return;
+		} else {
+			float t0 = (lo - origin[i]) / direction[i];
+			float t1 = (hi - origin[i]) / direction[i];
+			t_enter = std::max(t_enter, std::min(t0, t1));
+			t_exit = std::min(t_exit, std::max(t0, t1));
+		}
+	}
+	if (t_enter > t_exit) return;
+
+	//step from cell to cell (Amanatides & Woo style):
+	glm::uvec3 c = grid.cell_of(origin + t_enter * direction);
+	int32_t cell[3] = { int32_t(c.x), int32_t(c.y), int32_t(c.z) };
+	int32_t step[3];
+	float t_next[3]; //t at which the ray crosses into the next cell along each axis
+	float t_delta[3]; //t between crossings along each axis
+	for (int i = 0; i < 3; ++i) {
+		if (direction[i] > 0.0f) {
+			step[i] = 1;
+			t_next[i] = (grid.min[i] + (cell[i] + 1) * grid.cell - origin[i]) / direction[i];
+			t_delta[i] = grid.cell / direction[i];
+		} else if (direction[i] < 0.0f) {
+			step[i] = -1;
+			t_next[i] = (grid.min[i] + cell[i] * grid.cell - origin[i]) / direction[i];
+			t_delta[i] = -grid.cell / direction[i];
+		} else {
+			step[i] = 0;
+			t_next[i] = std::numeric_limits< float >::infinity();
+			t_delta[i] = std::numeric_limits< float >::infinity();
+		}
+	}
+
+	while (true) {
+		int axis = (t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2));
+		float t_leave = std::min(t_next[axis], t_exit);
+		if (!fn(grid.index(glm::uvec3(cell[0], cell[1], cell[2])), t_leave)) return;
+		if (t_next[axis] > t_exit) return;
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= int32_t(grid.size[axis])) return;
+		t_next[axis] += t_delta[axis];
+	}
+}
+
+//Moller-Trumbore ray/triangle intersection (either side); on a hit, sets t and barycentric weights:
+static bool intersect_triangle(glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c, glm::vec3 const &origin, glm::vec3 const &direction, float *t_, glm::vec3 *weights_) {
+	glm::vec3 e1 = b - a;
+	glm::vec3 e2 = c - a;
+	glm::vec3 p = glm::cross(direction, e2);
+	float det = glm::dot(e1, p);
+	if (std::abs(det) < 1e-12f) return false; //ray parallel to triangle
+	float inv_det = 1.0f / det;
+	glm::vec3 s = origin - a;
+	float u = glm::dot(s, p) * inv_det;
+	if (u < 0.0f || u > 1.0f) return false;
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(direction, q) * inv_det;
+	if (v < 0.0f || u + v > 1.0f) return false;
+	*t_ = glm::dot(e2, q) * inv_det;
+	*weights_ = glm::vec3(1.0f - u - v, u, v);
+	return true;
+}
+
+bool WalkMesh::ray_cast(glm::vec3 const &origin, glm::vec3 const &direction, float max_t, WalkPoint *hit, float *hit_t) const {
+	float best_t = std::numeric_limits< float >::infinity();
+	WalkPoint best;
+	auto check_triangle = [&](uint32_t ti) {
+		if (blocked[ti]) return;
+		glm::uvec3 const &tri = triangles[ti];
+		float t;
+		glm::vec3 weights;
+		if (intersect_triangle(vertices[tri.x], vertices[tri.y], vertices[tri.z], origin, direction, &t, &weights)
+		 && t >= 0.0f && t <= max_t && t < best_t) {
+			best_t = t;
+			best.index = ti;
+			best.triangle = tri;
+			best.weights = weights;
+		}
+	};
+	for_cells_along(grid, origin, direction, max_t, [&](uint32_t c, float t_leave) {
+		for (uint32_t i = grid.first[c], end = i + grid.count[c]; i < end; ++i) {
+			check_triangle(grid.triangles[i]);
+		}
+		//(triangles can span several cells, so a hit found here may lie in a later cell)
+		return best_t > t_leave;
+	});
+	if (best.index == -1U) return false;
+	if (hit) *hit = best;
+	if (hit_t) *hit_t = best_t;
+	return true;
+}
+
+bool WalkMesh::segment_hits(glm::vec3 const &a, glm::vec3 const &b) const {
+	auto hits_triangle = [&](uint32_t ti) {
+		if (blocked[ti]) return false;
+		glm::uvec3 const &tri = triangles[ti];
+		float t;
+		glm::vec3 weights;
+		return intersect_triangle(vertices[tri.x], vertices[tri.y], vertices[tri.z], a, b - a, &t, &weights)
+		    && t >= 0.0f && t <= 1.0f;
+	};
+	bool found = false;
+	for_cells_along(grid, a, b - a, 1.0f, [&](uint32_t c, float) {
+		for (uint32_t i = grid.first[c], end = i + grid.count[c]; i < end; ++i) {
+			if (hits_triangle(grid.triangles[i])) {
+				found = true;
+				return false;
+			}
+		}
+		return true;
+	});
+	return found;
+}
+
+void WalkMesh::ray_cast(glm::vec3 const *origins, glm::vec3 const *directions, float max_t, size_t count, WalkPoint *hits, float *hit_ts) const {
+	split_across_threads(count, MinRaysPerThread, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			if (!ray_cast(origins[i], directions[i], max_t, &hits[i], (hit_ts ? &hit_ts[i] : nullptr))) {
+				hits[i] = WalkPoint();
+				if (hit_ts) hit_ts[i] = std::numeric_limits< float >::infinity();
+			}
+		}
+	});
+}
+
+//per-thread working memory for find_path, kept between calls so that searches don't allocate:
+struct PathScratch {
+	//per-triangle search state (only valid where visited[t] == generation):
+	// (position is where the search entered the triangle)
+	std::vector< uint32_t > visited;
+	std::vector< float > cost;
+	std::vector< uint32_t > parent;
+	std::vector< glm::vec3 > position;
+	uint32_t generation = 0;
+	//open list, as a heap on (cost + estimate):
+	std::vector< std::pair< float, uint32_t > > open;
+	//funnel inputs:
+	std::vector< uint32_t > corridor;
+	std::vector< glm::vec3 > lefts, rights;
+};
+static thread_local PathScratch path_scratch;
+
+bool WalkMesh::find_path(WalkPoint const &from, WalkPoint const &to, std::vector< glm::vec3 > *path_) const {
+	assert(path_);
+	auto &path = *path_;
+	path.clear();
+
+	assert(from.index < triangles.size() && from.triangle == triangles[from.index]);
+	assert(to.index < triangles.size() && to.triangle == triangles[to.index]);
+
+	if (blocked[from.index] || blocked[to.index]) return false;
+
+	PathScratch &scratch = path_scratch;
+	std::vector< uint32_t > &corridor = scratch.corridor;
+	corridor.clear();
+
+	//look for a cached corridor:
+	uint32_t slot = (from.index * 2654435761U ^ to.index) % PathCacheSize;
+	bool cached = false;
+	{
+		std::lock_guard< std::mutex > guard(path_cache->mutex);
+		PathCache::Entry const &entry = path_cache->entries[slot];
+		if (entry.from == from.index && entry.to == to.index) {
+			corridor.assign(entry.corridor.begin(), entry.corridor.end());
+			cached = true;
+		}
+	}
+
+	if (!cached) {
+		//A* over triangles, moving between portal midpoints:
+		// (the corridor only depends on the triangles, not the exact endpoints, so it can be cached)
+		if (scratch.visited.size() < triangles.size()) {
+			scratch.visited.resize(triangles.size(), 0);
+			scratch.cost.resize(triangles.size());
+			scratch.parent.resize(triangles.size());
+			scratch.position.resize(triangles.size());
+		}
+		scratch.generation += 1;
+		if (scratch.generation == 0) {
+			std::fill(scratch.visited.begin(), scratch.visited.end(), 0);
+			scratch.generation = 1;
+		}
+		uint32_t const generation = scratch.generation;
+
+		glm::vec3 const &goal = centers[to.index];
+		auto &open = scratch.open;
+		open.clear();
+		auto push = [&](uint32_t t, float cost, uint32_t parent, glm::vec3 const &position) {
+			scratch.visited[t] = generation;
+			scratch.cost[t] = cost;
+			scratch.parent[t] = parent;
+			scratch.position[t] = position;
+			open.emplace_back(cost + glm::length(goal - position), t);
+			std::push_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+		};
+		push(from.index, 0.0f, -1U, centers[from.index]);
+
+		bool found = false;
+		while (!open.empty()) {
+			std::pop_heap(open.begin(), open.end(), std::greater< std::pair< float, uint32_t > >());
+			uint32_t t = open.back().second;
+			float estimate = open.back().first;
+			open.pop_back();
+			float cost = scratch.cost[t];
+			if (estimate > cost + glm::length(goal - scratch.position[t])) continue; //stale entry; t was reached more cheaply since
+
+			if (t == to.index) {
+				found = true;
+				break;
+			}
+			for (uint32_t k = 0; k < 3; ++k) {
+				uint32_t n = adjacent[t][k];
+				if (n == -1U || blocked[n]) continue;
+				glm::vec3 const &mid = portal_midpoints[3*t+k];
+				float n_cost = cost + glm::length(mid - scratch.position[t]);
+				if (scratch.visited[n] != generation || n_cost < scratch.cost[n]) {
+					push(n, n_cost, t, mid);
+				}
+			}
+		}
+
+		if (found) {
+			for (uint32_t t = to.index; t != -1U; t = scratch.parent[t]) {
+				corridor.emplace_back(t);
+			}
+			std::reverse(corridor.begin(), corridor.end());
+		}
+
+		std::lock_guard< std::mutex > guard(path_cache->mutex);
+		PathCache::Entry &entry = path_cache->entries[slot];
+		entry.from = from.index;
+		entry.to = to.index;
+		entry.corridor.assign(corridor.begin(), corridor.end());
+	}
+
+	if (corridor.empty()) return false;
+	assert(corridor.front() == from.index && corridor.back() == to.index);
+
+	//portals between successive triangles of the corridor, as seen walking along it:
+	// (from a triangle's interior, its edge [a,b] has 'a' on the right and 'b' on the left)
+	glm::vec3 start = world_point(from);
+	glm::vec3 end = world_point(to);
+	auto &lefts = scratch.lefts;
+	auto &rights = scratch.rights;
+	lefts.clear();
+	rights.clear();
+	lefts.emplace_back(start);
+	rights.emplace_back(start);
+	glm::vec3 up = glm::vec3(0.0f); //area-weighted average normal, used to tell left from right
+	for (uint32_t i = 0; i < corridor.size(); ++i) {
+		glm::uvec3 const &tri = triangles[corridor[i]];
+		up += glm::cross(vertices[tri.y] - vertices[tri.x], vertices[tri.z] - vertices[tri.x]);
+		if (i + 1 == corridor.size()) break;
+		glm::uvec3 const &adj = adjacent[corridor[i]];
+		uint32_t k = (adj.x == corridor[i+1] ? 0 : (adj.y == corridor[i+1] ? 1 : 2));
+		assert(adj[k] == corridor[i+1]);
+		rights.emplace_back(vertices[tri[(k+1)%3]]);
+		lefts.emplace_back(vertices[tri[(k+2)%3]]);
+	}
+	lefts.emplace_back(end);
+	rights.emplace_back(end);
+
+	//twice the signed area of (a,b,c) as seen from above -- positive when c is left of the line from a to b:
+	auto area = [&up](glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c) {
+		return glm::dot(up, glm::cross(b - a, c - a));
+	};
+
+	//pull the path tight with the "simple stupid funnel algorithm":
+	path.emplace_back(start);
+	glm::vec3 apex = start, left = start, right = start;
+	uint32_t apex_i = 0, left_i = 0, right_i = 0;
+	for (uint32_t i = 1; i < lefts.size(); ++i) {
+		glm::vec3 const &l = lefts[i];
+		glm::vec3 const &r = rights[i];
+
+		//does the new right side narrow the funnel?
+		if (area(apex, right, r) >= 0.0f) {
+			if (apex == right || area(apex, left, r) < 0.0f) {
+				right = r;
+				right_i = i;
+			} else {
+				//crossed over the left side, so the left side is a corner:
+				if (path.back() != left) path.emplace_back(left);
+				apex = left;
+				apex_i = left_i;
+				right = apex;
+				right_i = apex_i;
+				i = apex_i;
+				continue;
+			}
+		}
+
+		//does the new left side narrow the funnel?
+		if (area(apex, left, l) <= 0.0f) {
+			if (apex == left || area(apex, right, l) > 0.0f) {
+				left = l;
+				left_i = i;
+			} else {
+				//crossed over the right side, so the right side is a corner:
+				if (path.back() != right) path.emplace_back(right);
+				apex = right;
+				apex_i = right_i;
+				left = apex;
+				left_i = apex_i;
+				i = apex_i;
+				continue;
+			}
+		}
+	}
+	if (path.back() != end) path.emplace_back(end);
+
+	return true;
+}
+
+void WalkMesh::set_blocked(uint32_t triangle, bool block) {
+	assert(triangle < triangles.size());
+	if (bool(blocked[triangle]) == block) return;
+	blocked[triangle] = (block ? 1 : 0);
+
+	std::lock_guard< std::mutex > guard(path_cache->mutex);
+	if (block) {
+		//only routes through the triangle are affected:
+		forget_paths_through(&triangle, 1);
+	} else {
+		//any route might now have a shortcut (or have become possible):
+		for (auto &entry : path_cache->entries) {
+			entry.from = entry.to = -1U;
+		}
+	}
+}
+
+void WalkMesh::patch_vertices(std::vector< uint32_t > const &indices, std::vector< glm::vec3 > const &positions, std::vector< glm::vec3 > const &new_normals) {
+	assert(indices.size() == positions.size());
+	assert(indices.size() == new_normals.size());
+
+	//build vertex-to-triangle lists the first time they are needed:
+	if (vertex_triangles_first.empty()) {
+		vertex_triangles_first.assign(vertices.size() + 1, 0);
+		for (auto const &tri : triangles) {
+			vertex_triangles_first[tri.x+1] += 1;
+			vertex_triangles_first[tri.y+1] += 1;
+			vertex_triangles_first[tri.z+1] += 1;
+		}
+		for (uint32_t v = 1; v < vertex_triangles_first.size(); ++v) {
+			vertex_triangles_first[v] += vertex_triangles_first[v-1];
+		}
+		vertex_triangles.resize(vertex_triangles_first.back());
+		std::vector< uint32_t > next(vertex_triangles_first.begin(), vertex_triangles_first.end() - 1);
+		for (uint32_t ti = 0; ti < triangles.size(); ++ti) {
+			vertex_triangles[next[triangles[ti].x]++] = ti;
+			vertex_triangles[next[triangles[ti].y]++] = ti;
+			vertex_triangles[next[triangles[ti].z]++] = ti;
+		}
+	}
+
+	//find triangles touching the moved vertices:
+	std::vector< uint32_t > touched;
+	for (uint32_t v : indices) {
+		assert(v < vertices.size());
+		for (uint32_t i = vertex_triangles_first[v]; i < vertex_triangles_first[v+1]; ++i) {
+			touched.emplace_back(vertex_triangles[i]);
+		}
+	}
+	std::sort(touched.begin(), touched.end());
+	touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+	//range of grid cells a triangle's bounding box overlaps:
+	auto cells_of = [this](uint32_t ti) {
+		glm::uvec3 const &tri = triangles[ti];
+		return std::make_pair(
+			grid.cell_of(glm::min(vertices[tri.x], glm::min(vertices[tri.y], vertices[tri.z]))),
+			grid.cell_of(glm::max(vertices[tri.x], glm::max(vertices[tri.y], vertices[tri.z])))
+		);
+	};
+	std::vector< std::pair< glm::uvec3, glm::uvec3 > > old_cells;
+	if (!grid.first.empty()) {
+		old_cells.reserve(touched.size());
+		for (uint32_t ti : touched) {
+			old_cells.emplace_back(cells_of(ti));
+		}
+	}
+
+	for (uint32_t i = 0; i < indices.size(); ++i) {
+		vertices[indices[i]] = positions[i];
+		normals[indices[i]] = new_normals[i];
+	}
+
+	//the grid can't hold triangles outside its bounds, so if any were moved there, the grid has to grow:
+	bool outside = false;
+	if (!grid.first.empty()) {
+		glm::vec3 grid_max = grid.min + glm::vec3(grid.size) * grid.cell;
+		for (uint32_t ti : touched) {
+			glm::uvec3 const &tri = triangles[ti];
+			for (uint32_t k = 0; k < 3; ++k) {
+				glm::vec3 const &v = vertices[tri[k]];
+				if (v.x < grid.min.x || v.y < grid.min.y || v.z < grid.min.z || v.x > grid_max.x || v.y > grid_max.y || v.z > grid_max.z) outside = true;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < touched.size(); ++i) {
+		uint32_t ti = touched[i];
+		update_triangle(ti);
+		if (grid.first.empty() || outside) continue;
+
+		//move the triangle out of the cells it left and into the cells it now overlaps:
+		glm::uvec3 old_lo = old_cells[i].first, old_hi = old_cells[i].second;
+		auto new_cells = cells_of(ti);
+		glm::uvec3 new_lo = new_cells.first, new_hi = new_cells.second;
+		if (old_lo == new_lo && old_hi == new_hi) continue;
+		auto inside = [](glm::uvec3 const &c, glm::uvec3 const &lo, glm::uvec3 const &hi) {
+			return c.x >= lo.x && c.y >= lo.y && c.z >= lo.z && c.x <= hi.x && c.y <= hi.y && c.z <= hi.z;
+		};
+		for (uint32_t z = old_lo.z; z <= old_hi.z; ++z) {
+			for (uint32_t y = old_lo.y; y <= old_hi.y; ++y) {
+				for (uint32_t x = old_lo.x; x <= old_hi.x; ++x) {
+					glm::uvec3 c(x,y,z);
+					if (!inside(c, new_lo, new_hi)) grid.remove(grid.index(c), ti);
+				}
+			}
+		}
+		for (uint32_t z = new_lo.z; z <= new_hi.z; ++z) {
+			for (uint32_t y = new_lo.y; y <= new_hi.y; ++y) {
+				for (uint32_t x = new_lo.x; x <= new_hi.x; ++x) {
+					glm::uvec3 c(x,y,z);
+					if (!inside(c, old_lo, old_hi)) grid.add(grid.index(c), ti);
+				}
+			}
+		}
+	}
+	if (outside) rebuild_grid();
+
+	std::lock_guard< std::mutex > guard(path_cache->mutex);
+	forget_paths_through(touched.data(), touched.size());
+}
+
+void WalkMesh::forget_paths_through(uint32_t const *changed, size_t count) {
+	for (auto &entry : path_cache->entries) {
+		if (entry.from == -1U) continue;
+		for (uint32_t t : entry.corridor) {
+			if (std::find(changed, changed + count, t) != changed + count) {
+				entry.from = entry.to = -1U;
+				break;
+			}
+		}
+	}
+}
+
 
 WalkMeshes::WalkMeshes(std::string const &filename) {
 	std::ifstream file(filename, std::ios::binary);
 
+	//baked files start with a "wmb0" chunk (mesh names) and an "idxB" chunk (name ranges), followed by each mesh's chunks:
+	char magic[4] = {'\0', '\0', '\0', '\0'};
+	file.read(magic, 4);
+	file.seekg(0);
+	if (std::string(magic, 4) == "wmb0") {
+		std::vector< char > names;
+		read_chunk(file, "wmb0", &names);
+
+		std::vector< glm::uvec2 > index;
+		read_chunk(file, "idxB", &index);
+
+		for (auto const &e : index) {
+			if (!(e.x <= e.y && e.y <= names.size())) {
+				throw std::runtime_error("Invalid name indices in index of '" + filename + "'");
+			}
+			std::string name(names.begin() + e.x, names.begin() + e.y);
+			auto ret = meshes.emplace(name, WalkMesh(file));
+			if (!ret.second) {
+				throw std::runtime_error("WalkMesh with duplicated name '" + name + "' in '" + filename + "'");
+			}
+		}
+
+		if (file.peek() != EOF) {
+			std::cerr << "WARNING: trailing data in walkmesh file '" << filename << "'" << std::endl;
+		}
+		return;
+	}
+
 	std::vector< glm::vec3 > vertices;
 	read_chunk(file, "p...", &vertices);
 
@@ -289,6 +1101,27 @@ WalkMeshes::WalkMeshes(std::string const &filename) {
 	}
 }
 
+void WalkMeshes::save_baked(std::string const &filename) const {
+	std::ofstream file(filename, std::ios::binary);
+
+	std::vector< char > names;
+	std::vector< glm::uvec2 > index;
+	for (auto const &nm : meshes) {
+		index.emplace_back(uint32_t(names.size()), uint32_t(names.size() + nm.first.size()));
+		names.insert(names.end(), nm.first.begin(), nm.first.end());
+	}
+	write_chunk(file, "wmb0", names);
+	write_chunk(file, "idxB", index);
+
+	for (auto const &nm : meshes) {
+		nm.second.save(file);
+	}
+
+	if (!file) {
+		throw std::runtime_error("Failed to write baked walkmeshes to '" + filename + "'");
+	}
+}
+
 WalkMesh const &WalkMeshes::lookup(std::string const &name) const {
 	auto f = meshes.find(name);
 	if (f == meshes.end()) {
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <glm/glm.hpp>
+
+#include <iosfwd>
 #include <vector>
-#include <unordered_map>
 #include <map>
-
-#define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/hash.hpp> //allows the use of 'uvec2' as an unordered_map key
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
 
 struct WalkMesh {
 	//Walk mesh will keep track of triangles, vertices:
@@ -13,25 +16,120 @@ struct WalkMesh {
 	std::vector< glm::vec3 > normals; //normals for interpolated 'up' direction
 	std::vector< glm::uvec3 > triangles; //CCW-oriented
 
-	//This "next vertex" map includes [a,b]->c, [b,c]->a, and [c,a]->b for each triangle, and is useful for checking what's over an edge from a given point:
-	std::unordered_map< glm::uvec2, uint32_t > next_vertex;
-
-
-	//Construct new WalkMesh and build next_vertex structure:
+	//Triangle adjacency: for triangle [a,b,c], adjacent[t].x is the triangle across edge [b,c], .y across [c,a], and .z across [a,b]:
+	// (-1U means the edge is on the boundary of the mesh)
+	std::vector< glm::uvec3 > adjacent;
+
+	//For each triangle, a matrix that takes a world-space step to the change in barycentric coordinates it causes:
+	// (the part of the step perpendicular to the triangle is ignored)
+	std::vector< glm::mat3 > step_to_weights;
+
+	//Portal graph used by find_path -- triangles connect to adjacent triangles through their edges ("portals"):
+	std::vector< glm::vec3 > centers; //centers[t] is the centroid of triangle t
+	std::vector< glm::vec3 > portal_midpoints; //portal_midpoints[3*t+k] is the midpoint of the edge of triangle t opposite vertex k
+
+	//Uniform grid of cube-shaped cells over the mesh; each cell lists the triangles whose bounding boxes overlap it:
+	// (used to only look at nearby triangles when searching for the closest point or casting rays)
+	struct Grid {
+		glm::vec3 min = glm::vec3(0.0f); //corner of cell (0,0,0)
+		float cell = 1.0f; //cell side length
+		glm::uvec3 size = glm::uvec3(0U); //number of cells along each axis
+		//triangles overlapping cell c are triangles[first[c]] ... triangles[first[c]+count[c]-1]:
+		// (there is room for capacity[c] entries there; a cell that outgrows it is moved to the end of 'triangles')
+		std::vector< uint32_t > first;
+		std::vector< uint32_t > count;
+		std::vector< uint32_t > capacity;
+		std::vector< uint32_t > triangles;
+
+		//used by patch_vertices to move a triangle between cells:
+		void add(uint32_t c, uint32_t triangle);
+		void remove(uint32_t c, uint32_t triangle);
+
+		//index of the cell containing (or, for points outside the grid, closest to) a point:
+		glm::uvec3 cell_of(glm::vec3 const &pt) const;
+		uint32_t index(glm::uvec3 const &c) const {
+			return (c.z * size.y + c.y) * size.x + c.x;
+		}
+	} grid;
+
+	//Blocked triangles act as if they were cut out of the mesh:
+	// (blocked[t] is nonzero if triangle t is blocked)
+	std::vector< uint8_t > blocked;
+
+	//Construct new WalkMesh and build adjacency and grid structures:
 	WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_);
 
+	//Read a WalkMesh written by 'save', including its adjacency and grid structures (nothing is rebuilt or checked):
+	WalkMesh(std::istream &from);
+	void save(std::ostream &to) const;
+
 	struct WalkPoint {
-		glm::uvec3 triangle = glm::uvec3(-1U); //indices of current triangle
+		uint32_t index = -1U; //index of current triangle in 'triangles'
+		glm::uvec3 triangle = glm::uvec3(-1U); //vertex indices of current triangle (always triangles[index])
 		glm::vec3 weights = glm::vec3(std::numeric_limits< float >::quiet_NaN()); //barycentric coordinates for current point
 	};
 
 	//used to initialize walking -- finds the closest point on the walk mesh:
-	// (should only need to call this at the start of a level)
+	// (only examines triangles in grid cells near world_point, so it's cheap enough to call when spawning or teleporting)
 	WalkPoint start(glm::vec3 const &world_point) const;
 
+	//Runtime changes (opening doors, placing objects, ...):
+	// (not safe to call while other threads are querying the mesh; WalkFlowFields over the mesh need a refresh() afterward)
+
+	//used to block or unblock a triangle -- walking treats blocked triangles' edges as walls, and queries skip them:
+	void set_blocked(uint32_t triangle, bool block);
+
+	//used to move some vertices (e.g., for a drawbridge); updates the triangles around them and moves them between grid cells:
+	// (pass the vertices' new normals too, since world_normal() -- and so WalkCrowd's avoidance plane -- interpolates them)
+	// (moving vertices outside the grid's bounds rebuilds the whole grid; rebuild_grid() also re-packs the grid after moving large areas)
+	void patch_vertices(std::vector< uint32_t > const &indices, std::vector< glm::vec3 > const &positions, std::vector< glm::vec3 > const &new_normals);
+	void rebuild_grid();
+
 	//used to update walk point:
 	void walk(WalkPoint &wp, glm::vec3 const &step) const;
 
+	//used to update many walk points at once (wps[i] is moved by steps[i]):
+	// (points that stay inside their triangle take a fast path; batches of more than MinWalkPointsPerThread points are split across threads)
+	void walk(WalkPoint *wps, glm::vec3 const *steps, size_t count) const;
+	static constexpr size_t MinWalkPointsPerThread = 2048;
+
+	//used to plan a route across the mesh -- fills 'path' with world-space points from 'from' to 'to', pulled tight around corners:
+	// (returns false and clears 'path' if 'to' can't be reached from 'from')
+	// Safe to call from several threads at once; routes between recently-queried triangle pairs come from path_cache.
+	bool find_path(WalkPoint const &from, WalkPoint const &to, std::vector< glm::vec3 > *path) const;
+
+	//used to find the first point on the mesh along the ray origin + t * direction, for t in [0, max_t]:
+	// (returns false if the ray misses; 'hit_t', if given, is set to the t of the hit)
+	bool ray_cast(glm::vec3 const &origin, glm::vec3 const &direction, float max_t, WalkPoint *hit, float *hit_t = nullptr) const;
+
+	//used to check if the segment from a to b touches the mesh at all (e.g., for line-of-sight checks):
+	// (cheaper than ray_cast because it stops at the first triangle hit)
+	bool segment_hits(glm::vec3 const &a, glm::vec3 const &b) const;
+
+	//ray_cast for many rays at once; misses are left as a default WalkPoint (index -1U) with hit_t of infinity:
+	// (batches of more than MinRaysPerThread rays are split across threads)
+	void ray_cast(glm::vec3 const *origins, glm::vec3 const *directions, float max_t, size_t count, WalkPoint *hits, float *hit_ts = nullptr) const;
+	static constexpr size_t MinRaysPerThread = 256;
+
+	//Recently-found triangle sequences, direct-mapped on (from, to) triangle pair:
+	struct PathCache {
+		struct Entry {
+			uint32_t from = -1U, to = -1U;
+			std::vector< uint32_t > corridor; //triangles from 'from' to 'to' (empty if unreachable)
+		};
+		std::mutex mutex;
+		std::vector< Entry > entries;
+	};
+	static constexpr uint32_t PathCacheSize = 1024;
+	std::unique_ptr< PathCache > path_cache;
+
+	//internals:
+	void update_triangle(uint32_t triangle); //recompute centers, portal_midpoints, and step_to_weights for a triangle
+	void forget_paths_through(uint32_t const *triangles, size_t count); //drop cached corridors that use any of the triangles (call with path_cache->mutex held)
+	//triangles using vertex v are vertex_triangles[vertex_triangles_first[v]] ... (built by the first patch_vertices call):
+	std::vector< uint32_t > vertex_triangles_first;
+	std::vector< uint32_t > vertex_triangles;
+
 	//used to read back results of walking:
 	glm::vec3 world_point(WalkPoint const &wp) const {
 		return wp.weights.x * vertices[wp.triangle.x]
@@ -51,8 +149,12 @@ struct WalkMesh {
 
 struct WalkMeshes {
 	//load a list of named WalkMeshes from a file:
+	// (either as exported from blender, or as written by save_baked)
 	WalkMeshes(std::string const &filename);
 
+	//write meshes in "baked" form, which loads without any per-mesh construction:
+	void save_baked(std::string const &filename) const;
+
 	//retrieve a WalkMesh by name:
 	WalkMesh const &lookup(std::string const &name) const;
 
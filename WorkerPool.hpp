@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Worker threads shared by everything that farms work out (sample decoding, batched walks and ray casts, crowds):
+// threads are started on first use, one fewer than the core count so the calling thread keeps a core.
+// (the mixer keeps its own workers in Sound.cpp, because the audio thread can't wait behind a queued decode)
+struct WorkerPool {
+	//the pool everyone shares:
+	static WorkerPool &shared();
+
+	//run 'job' on some worker, after the jobs already queued:
+	void run(std::function< void() > const &job);
+
+	//runs any jobs still queued, then stops the workers:
+	~WorkerPool();
+
+	//internals:
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::list< std::function< void() > > jobs;
+	std::vector< std::thread > threads;
+	bool quit = false;
+	void work();
+};
+
+inline WorkerPool &WorkerPool::shared() {
+	static WorkerPool pool;
+	return pool;
+}
+
+inline void WorkerPool::run(std::function< void() > const &job) {
+	std::lock_guard< std::mutex > guard(mutex);
+	if (threads.empty()) {
+		uint32_t count = std::max(1U, std::thread::hardware_concurrency());
+		count = std::max(1U, count - 1);
+		for (uint32_t i = 0; i < count; ++i) {
+			threads.emplace_back([this](){ work(); });
+		}
+	}
+	jobs.emplace_back(job);
+	cv.notify_one();
+}
+
+inline void WorkerPool::work() {
+	while (true) {
+		std::function< void() > job;
+		{
+			std::unique_lock< std::mutex > guard(mutex);
+			cv.wait(guard, [this](){ return quit || !jobs.empty(); });
+			if (jobs.empty()) return; //quit, and nothing left to do
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+	}
+}
+
+inline WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard< std::mutex > guard(mutex);
+		quit = true;
+	}
+	cv.notify_all();
+	for (auto &t : threads) t.join();
+}
+
+//call fn(begin, end) on ranges covering [0,count), on up to one thread per core (each handling at least min_per_thread items):
+// ranges are claimed by whichever thread gets to them first -- the calling thread included -- so if the pool's
+// workers are busy with other jobs the caller just handles more of the ranges itself.
+inline void split_across_threads(size_t count, size_t min_per_thread, std::function< void(size_t, size_t) > const &fn) {
+	uint32_t threads = std::max(1U, std::thread::hardware_concurrency());
+	threads = uint32_t(std::min< size_t >(threads, count / min_per_thread));
+	if (threads <= 1) {
+		fn(0, count);
+		return;
+	}
+
+	//shared with the helper jobs, which may only get to run after this call has returned:
+	struct Split {
+		std::function< void(size_t, size_t) > const *fn = nullptr; //(only used while ranges are left)
+		size_t count = 0;
+		uint32_t ranges = 0;
+		std::atomic< uint32_t > next{0};
+		std::mutex mutex;
+		std::condition_variable cv;
+		uint32_t finished = 0; //(guarded by mutex)
+
+		void work() {
+			while (true) {
+				uint32_t r = next.fetch_add(1);
+				if (r >= ranges) return;
+				(*fn)(count * r / ranges, count * (r + 1) / ranges);
+				std::lock_guard< std::mutex > guard(mutex);
+				finished += 1;
+				if (finished == ranges) cv.notify_all();
+			}
+		}
+	};
+	std::shared_ptr< Split > split = std::make_shared< Split >();
+	split->fn = &fn;
+	split->count = count;
+	split->ranges = threads;
+
+	WorkerPool &pool = WorkerPool::shared();
+	for (uint32_t t = 1; t < threads; ++t) {
+		pool.run([split](){ split->work(); });
+	}
+	split->work();
+
+	std::unique_lock< std::mutex > guard(split->mutex);
+	split->cv.wait(guard, [&split](){ return split->finished == split->ranges; });
+}
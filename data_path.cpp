@@ -1,6 +1,8 @@
 #include "data_path.hpp"
 
+#include <cstdlib>
 #include <iostream>
+#include <stdexcept>
 #include <vector>
 #include <sstream>
 
@@ -12,6 +14,7 @@
 #include <io.h>
 #elif defined(__APPLE__)
 #include <mach-o/dyld.h>
+#include <sys/stat.h>
 #elif defined(__linux__)
 #include <unistd.h>
 #include <sys/stat.h>
@@ -71,3 +74,55 @@ std::string data_path(std::string const &suffix) {
 	static std::string path = get_data_path();
 	return path + "/" + suffix;
 }
+
+//get_user_path() gets (and creates, if needed) a per-user directory for this game's files:
+static std::string get_user_path() {
+	const std::string Folder = "MusicalBloom";
+
+	#if defined(_WIN32)
+	PWSTR local_app_data = nullptr;
+	if (SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, NULL, &local_app_data) != S_OK) {
+		CoTaskMemFree(local_app_data);
+		throw std::runtime_error("Failed to find the local application data folder.");
+	}
+	std::wstring wide = local_app_data;
+	CoTaskMemFree(local_app_data);
+	std::string ret(wide.begin(), wide.end()); //NOTE: assumes the path is ASCII
+	ret += "\\" + Folder;
+	_mkdir(ret.c_str());
+	return ret;
+
+	#else
+	char const *home = getenv("HOME");
+	if (!home) {
+		throw std::runtime_error("Can't find a user directory ($HOME isn't set).");
+	}
+	#if defined(__APPLE__)
+	std::string ret = std::string(home) + "/Library/Application Support/" + Folder;
+	#else
+	char const *xdg = getenv("XDG_DATA_HOME");
+	std::string base = (xdg && xdg[0] ? std::string(xdg) : std::string(home) + "/.local/share");
+	mkdir((std::string(home) + "/.local").c_str(), 0755);
+	mkdir(base.c_str(), 0755);
+	std::string ret = base + "/" + Folder;
+	#endif
+	mkdir(ret.c_str(), 0755); //(fails harmlessly if it already exists)
+	return ret;
+	#endif
+}
+
+std::string user_path(std::string const &suffix) {
+	static std::string path = get_user_path();
+
+	//create any directories named in 'suffix':
+	for (size_t slash = suffix.find('/'); slash != std::string::npos; slash = suffix.find('/', slash + 1)) {
+		std::string dir = path + "/" + suffix.substr(0, slash);
+		#if defined(_WIN32)
+		_mkdir(dir.c_str());
+		#else
+		mkdir(dir.c_str(), 0755);
+		#endif
+	}
+
+	return path + "/" + suffix;
+}
@@ -37,6 +37,8 @@ int main(int argc, char **argv) {
 		//TODO: this is where you set the title and size of your game window
 		std::string title = "Musical Bloom";
 		glm::uvec2 size = glm::uvec2(640, 400);
+		//audio mix block size; smaller is lower latency (128/256/512 are good choices on fast machines) but costs more CPU:
+		uint32_t mix_samples = Sound::DefaultMixSamples;
 	} config;
 
 	/*
@@ -110,7 +112,7 @@ int main(int argc, char **argv) {
 	//SDL_ShowCursor(SDL_DISABLE);
 
 	//------------ init sound output --------------
-	Sound::init();
+	Sound::init(config.mix_samples);
 
 	//------------ load assets --------------
 
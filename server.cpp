@@ -1,4 +1,5 @@
 #include "Connection.hpp"
+#include "Protocol.hpp"
 #include "Game.hpp"
 
 #include <iostream>
@@ -15,22 +16,20 @@ int main(int argc, char **argv) {
 
 	Game state;
 
+	MessageDispatcher dispatcher;
+	set_message_handler< HelloMessage >(dispatcher, [&](Connection *c, HelloMessage const &hello) {
+		std::cout << c << ": Got hello." << std::endl;
+	});
+	set_message_handler< StateMessage >(dispatcher, [&](Connection *c, StateMessage const &message) {
+		state.paddle.x = message.paddle_x;
+	});
+
 	while (1) {
 		server.poll([&](Connection *c, Connection::Event evt){
 			if (evt == Connection::OnOpen) {
 			} else if (evt == Connection::OnClose) {
 			} else { assert(evt == Connection::OnRecv);
-				if (c->recv_buffer[0] == 'h') {
-					c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 1);
-					std::cout << c << ": Got hello." << std::endl;
-				} else if (c->recv_buffer[0] == 's') {
-					if (c->recv_buffer.size() < 1 + sizeof(float)) {
-						return; //wait for more data
-					} else {
-						memcpy(&state.paddle.x, c->recv_buffer.data() + 1, sizeof(float));
-						c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 1 + sizeof(float));
-					}
-				}
+				dispatcher.dispatch(c);
 			}
 		}, 0.01);
 		//every second or so, dump the current paddle position: